@@ -0,0 +1,530 @@
+// move.c is included rather than linked, to get at its internals
+#define NO_MAIN
+#include "move.c"
+#include <fcntl.h>
+#include <unistd.h>
+
+// an offline benchmark driven by recorded `/move` requests. every position is
+// searched twice, from a cleared transposition table and without any state
+// carried over between turns: once to a fixed depth on a single thread, which
+// is deterministic, and once for a fixed time on THREADS threads, which is what
+// a live game sees. the fixed-depth nodes, evals and move can be compared to a
+// saved baseline, so that speed-ups can be told apart from behavior changes:
+// an optimization should leave them alone and only make `MICROS` go down.
+// fixed-depth eval throughput is also broken down by the Voronoi kernel each
+// position's board size picks, see `kernels` in move.c
+
+// with `-p`, requests are parsed rather than searched instead: `parse()` is
+// timed against `parse_jsonw()`, then both are run on FUZZ random mutations of
+// every request and must agree on whatever is valid JSON. on anything else,
+// `parse()` must fail, since it validates the whole request
+//
+// with `-r distance` or `-B snakes`, every position is searched both the
+// plain paranoid way and with REDUCE set to `distance` or BRS set to `snakes`
+// instead, to see with how many fewer nodes it gets to the fixed depth and how
+// much deeper it gets in the fixed time
+//
+// with `-P depth`, moves are counted rather than searched instead: `perft()`
+// walks every position to `depth` plies without evaluating any, once checking
+// that every unmake restores the board bit for bit and once timed without the
+// checks. `NODES/S` is then raw make/unmake throughput, apart from `eval()`.
+// the corpus has a position of every ruleset, so that tails wrapping around,
+// hazard damage and constrictor growth all get unmade too
+//
+// with `-v depth`, the Voronoi kernels are checked against each other instead:
+// every position is walked `depth` plies deep, and at every step the children
+// are flood filled four at a time with the board's `fill4` and one at a time
+// with its `fill` and with the generic kernel, which must all agree
+
+// a larger DEPTH measures more of the search and less of the setup but takes
+// longer to run. a larger MAX_POSITIONS allows for larger corpora and
+// baselines. a larger PARSES times parsing more accurately and a larger FUZZ
+// catches more discrepancies between parsers, but both take longer to run
+#define DEPTH 20          // default depth for fixed-depth searches
+#define TIME 400          // default time for fixed-time searches, in millis
+#define MAX_POSITIONS 1024 // max number of positions, for allocating buffers
+#define PARSES 2000       // number of times to parse every request with `-p`
+#define FUZZ 5000         // number of mutations of every request with `-p`
+
+struct row {
+  char pos[256]; // `file:line` the request was found at
+  int depth;
+  long long nodes, evals;
+  char move[8];
+};
+
+int load(struct row *rows, char *path) {
+  // read a baseline written by `-w`. returns the number of rows or -1
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+    return perror(path), -1;
+
+  int n = 0;
+  char line[512];
+  while (fgets(line, sizeof line, file) && n < MAX_POSITIONS)
+    if (sscanf(line, "%255s %d %lld %lld %7s", rows[n].pos, &rows[n].depth,
+               &rows[n].nodes, &rows[n].evals, rows[n].move) == 5)
+      n++;
+
+  fclose(file);
+  return n;
+}
+
+bool same(struct board *a, struct board *b) {
+  // whether two parsers came up with the same board
+  if (a->width != b->width || a->height != b->height ||
+      a->rules != b->rules || a->hazard_damage != b->hazard_damage ||
+      bb_any(a->food ^ b->food | a->hazards ^ b->hazards))
+    return false;
+  for (struct snake *p = a->snakes, *q = b->snakes; p < a->snakes + MAX_SNAKES;
+       p++, q++)
+    if (bb_any(p->head ^ q->head | p->tail ^ q->tail | p->body ^ q->body |
+               p->axis ^ q->axis | p->sign ^ q->sign) ||
+        p->length != q->length || p->health != q->health ||
+        p->taillag != q->taillag)
+      return false;
+  return true;
+}
+
+int voronoi(struct board *board, int s, int depth, long long *n_lanes) {
+  // check the kernels on the children of the four moves of snake `s`, seeded
+  // the same way `step_kernel()` seeds them at depth 1, then on those of every
+  // child, `depth` plies deep. boards are copied rather than unmade, so
+  // nothing else is being tested. returns the number of mismatched lanes
+  int rules = board->rules, mismatches = 0;
+  if (depth == 0 || !board->snakes->health)
+    return 0;
+
+  // once every live snake has moved, move the tails to begin the next turn
+  while (s < MAX_SNAKES && !board->snakes[s].health)
+    s++;
+  if (s == MAX_SNAKES) {
+    struct board next = *board;
+    for (int r = 0; r < MAX_SNAKES; r++)
+      if (next.snakes[r].health) {
+        next.heads |= next.snakes[r].head;
+        if (!next.snakes[r].taillag)
+          move_tail(rules, r, &next);
+      }
+    return voronoi(&next, 0, depth, n_lanes);
+  }
+
+  struct kernel *generic = kernels;
+  while (generic->width || generic->wrapped != (rules == RULES_WRAPPED))
+    generic++;
+
+  // a move that goes off the board leaves its lane with the parent's seeds,
+  // and one that collides with its head in a body, which is a board no
+  // search would see but is as good a test as any
+  struct board children[4];
+  bool legal[4] = {0};
+  bb_t bodies[4], owned[4], lost[4], owned4[4], lost4[4];
+  for (int m = 0; m < 4; m++) {
+    struct board *child = children + m;
+    struct snake *snake = child->snakes + s;
+    *child = *board;
+    int cell = bb_ctz(snake->head);
+    child->heads &= ~snake->head;
+    if (!outside(rules, cell, m, child)) {
+      move_head(rules, snake, m, child);
+      if ((legal[m] = !bb_any(snake->head & child->bodies)))
+        move_body(rules, s, cell, m, child);
+    }
+    eval_seed(rules, child, bodies + m, owned + m, lost + m);
+    owned4[m] = owned[m], lost4[m] = lost[m];
+  }
+
+  board->kernel->fill4(board, bodies, owned4, lost4);
+  for (int m = 0; m < 4; m++) {
+    bb_t o = owned[m], l = lost[m], g_o = owned[m], g_l = lost[m];
+    board->kernel->fill(board, bodies[m], &o, &l);
+    generic->fill(board, bodies[m], &g_o, &g_l);
+    mismatches += bb_any(owned4[m] ^ o | lost4[m] ^ l | g_o ^ o | g_l ^ l);
+    ++*n_lanes;
+  }
+
+  for (int m = 0; m < 4; m++)
+    if (legal[m])
+      mismatches += voronoi(children + m, s + 1, depth - 1, n_lanes);
+  return mismatches;
+}
+
+void mutate(char *buf, size_t size, unsigned int *seed) {
+  // make a random edit to the NUL-terminated `buf`. edits are biased toward
+  // ones that keep it valid JSON, or nearly so, to get past the syntax checks
+  char *alphabet = "{}[]:,\"0123456789-.eE \t\n\\uxy";
+  size_t len = strlen(buf), at = rand_r(seed) % (len + 1);
+  char chr = alphabet[rand_r(seed) % strlen(alphabet)];
+  int edit = rand_r(seed) % 16;
+  if (edit == 0) // truncate
+    buf[at] = '\0';
+  else if (edit < 5 && at < len) // replace
+    buf[at] = chr;
+  else if (edit < 9 && at < len) // delete
+    memmove(buf + at, buf + at + 1, len - at);
+  else if (edit < 13 && len + 1 < size) // insert
+    memmove(buf + at + 1, buf + at, len - at + 1), buf[at] = chr;
+  else // change the next digit, if any
+    for (char *c = buf + at; *c; c++)
+      if (isdigit((unsigned char)*c)) {
+        *c = '0' + rand_r(seed) % 10;
+        break;
+      }
+}
+
+void check(char *pos, char *req, int *n_valid, int *n_mismatches) {
+  // time both parsers on `req`, then fuzz them against each other
+  volatile unsigned int sink = 0; // so the parsing isn't optimized out
+  clock_t times[2];
+  for (int i = 0; i < 2; i++) {
+    clock_t start = wall_clock();
+    for (int p = 0; p < PARSES; p++) {
+      struct board board = {0};
+      struct meta meta;
+      unsigned int seed = 0;
+      unsigned char prev_move = 4;
+      (i ? parse : parse_jsonw)(&board, &meta, &seed, &prev_move, req);
+      sink += seed;
+    }
+    times[i] = wall_clock() - start;
+  }
+
+  // both parsers log why they reject a request, which for mutated requests is
+  // just noise, so silence `stderr` for the time being
+  fflush(stderr);
+  int null = open("/dev/null", O_WRONLY), saved = dup(STDERR_FILENO);
+  if (null == -1 || saved == -1 || dup2(null, STDERR_FILENO) == -1)
+    perror("/dev/null"), exit(EXIT_FAILURE);
+
+  int valid = 0, mismatches = 0;
+  unsigned int seed = 0;
+  for (int f = 0; f < FUZZ; f++) {
+    static char buf[1 << 16];
+    snprintf(buf, sizeof buf, "%s", req);
+    for (int m = rand_r(&seed) % 3; m >= 0; m--)
+      mutate(buf, sizeof buf, &seed);
+
+    struct board boards[2] = {0};
+    struct meta metas[2];
+    unsigned int seeds[2] = {0};
+    unsigned char prev_moves[2] = {4, 4};
+    int rets[2] = {
+        parse_jsonw(boards, metas, seeds, prev_moves, buf),
+        parse(boards + 1, metas + 1, seeds + 1, prev_moves + 1, buf)};
+    char *end = jsonw_text(NULL, buf);
+    bool is_valid = end && *end == '\0';
+    valid += is_valid;
+    if (is_valid ? rets[0] != rets[1] ||
+                       rets[0] >= 0 && (!same(boards, boards + 1) ||
+                                        memcmp(metas, metas + 1,
+                                               sizeof *metas) ||
+                                        seeds[0] != seeds[1] ||
+                                        prev_moves[0] != prev_moves[1])
+                 : rets[1] >= 0)
+      mismatches++,
+          printf("%s: mutation %d %s\n%s\n", pos, f,
+                 is_valid ? "parsed differently" : "is invalid but parsed",
+                 buf);
+  }
+
+  fflush(stderr);
+  if (dup2(saved, STDERR_FILENO) == -1)
+    perror("dup2"), exit(EXIT_FAILURE);
+  close(null), close(saved);
+
+  printf("%s\t%lld\t%lld\t%.2f\t%d\t%d\t%d\n", pos,
+         (long long)times[0] * 1000000000 / CLOCKS_PER_SEC / PARSES,
+         (long long)times[1] * 1000000000 / CLOCKS_PER_SEC / PARSES,
+         (double)times[0] / (times[1] ? times[1] : 1), FUZZ, valid, mismatches);
+  *n_valid += valid, *n_mismatches += mismatches;
+}
+
+int main(int argc, char *argv[]) {
+  int depth = DEPTH, millis = TIME;
+  char *baseline = NULL, *output = NULL;
+  bool parsing = false;
+  int reduce = 0, brs = 0, perfting = 0, checking = 0;
+  for (int opt; (opt = getopt(argc, argv, "d:t:b:w:pr:B:P:v:")) != -1;)
+    switch (opt) {
+    case 'd':
+      depth = atoi(optarg);
+      break;
+    case 't':
+      millis = atoi(optarg);
+      break;
+    case 'b':
+      baseline = optarg;
+      break;
+    case 'w':
+      output = optarg;
+      break;
+    case 'p':
+      parsing = true;
+      break;
+    case 'r':
+      reduce = atoi(optarg);
+      break;
+    case 'B':
+      brs = atoi(optarg);
+      break;
+    case 'P':
+      if ((perfting = atoi(optarg)) < 1)
+        fputs("bad perft depth\n", stderr), exit(EXIT_FAILURE);
+      break;
+    case 'v':
+      if ((checking = atoi(optarg)) < 1)
+        fputs("bad kernel check depth\n", stderr), exit(EXIT_FAILURE);
+      break;
+    default:
+      fprintf(stderr,
+              "usage: %s [-d depth] [-t millis] [-b baseline] [-w baseline] "
+              "[-p | -r distance | -B snakes | -P depth | -v depth] file...\n",
+              *argv);
+      exit(EXIT_FAILURE);
+    }
+  if (depth < 1 || depth > MAX_DEPTH || millis < 1)
+    fputs("bad depth or time\n", stderr), exit(EXIT_FAILURE);
+
+  static struct row rows[MAX_POSITIONS], base[MAX_POSITIONS];
+  int n_rows = 0, n_base = 0;
+  if (baseline && (n_base = load(base, baseline)) < 0)
+    exit(EXIT_FAILURE);
+
+  struct limits fixed = {.depth = depth,
+                         .search_time = CLOCKS_PER_SEC * 3600,
+                         .total_time = CLOCKS_PER_SEC * 3600,
+                         .threads = 1,
+                         .reduce = REDUCE,
+                         .brs = BRS,
+                         .cold = true,
+                         .quiet = true};
+  clock_t budget = (clock_t)CLOCKS_PER_SEC * millis / 1000;
+  struct limits timed = {.depth = MAX_DEPTH,
+                         .search_time = budget,
+                         .total_time = budget,
+                         .threads = THREADS,
+                         .reduce = REDUCE,
+                         .brs = BRS,
+                         .cold = true,
+                         .quiet = true};
+
+  if (parsing)
+    printf("POS\tJSONW\tPARSE\tSPEEDUP\tFUZZED\tVALID\tMISMATCH\n");
+  else if (perfting)
+    printf("POS\tDEPTH\tNODES\tMICROS\tNODES/S\n");
+  else if (checking)
+    printf("POS\tDEPTH\tKERNEL\tLANES\tMISMATCH\n");
+  else if (reduce || brs)
+    printf("POS\tSNAKES\tNODES\tREACHED\tMOVE\tNODES\tREACHED\tMOVE\n");
+  else
+    printf("POS\tDEPTH\tNODES\tEVALS\tMICROS\tEVALS/S\tMOVE\t"
+           "REACHED\tEVALS/S\tMOVE\n");
+  long long n_evals = 0, n_micros = 0, n_nodes[2] = {0};
+  // fixed-depth evals and time per eval kernel, see `kernels` in move.c
+  long long k_evals[sizeof kernels / sizeof *kernels] = {0},
+            k_micros[sizeof kernels / sizeof *kernels] = {0};
+  int n_valid = 0, n_mismatches = 0;
+  bool failed = false;
+
+  // every file is scanned for JSON objects that start at the beginning of a
+  // line, so that pretty-printed requests like example-move.json, JSON Lines
+  // and logs with one request per line all work. objects that aren't `/move`
+  // requests are skipped
+  for (int f = optind; f < argc; f++) {
+    FILE *file = fopen(argv[f], "r");
+    if (file == NULL)
+      perror(argv[f]), exit(EXIT_FAILURE);
+    static char buf[1 << 24];
+    size_t size = fread(buf, 1, sizeof buf - 1, file);
+    if (ferror(file))
+      perror("fread"), exit(EXIT_FAILURE);
+    if (!feof(file))
+      fputs("file buffer exhausted\n", stderr), exit(EXIT_FAILURE);
+    buf[size] = '\0';
+    fclose(file);
+
+    int line = 1;
+    for (char *p = buf; *p; line += *p++ == '\n') {
+      if (*p != '{' || p != buf && p[-1] != '\n')
+        continue;
+      char *end = jsonw_object(NULL, p);
+      if (end == NULL || !jsonw_lookup("board", jsonw_beginobj(p)))
+        continue;
+      if (n_rows == MAX_POSITIONS)
+        fputs("too many positions\n", stderr), exit(EXIT_FAILURE);
+
+      static char req[1 << 16];
+      if (end - p >= sizeof req)
+        fputs("request buffer exhausted\n", stderr), exit(EXIT_FAILURE);
+      memcpy(req, p, end - p);
+      req[end - p] = '\0';
+
+      struct row *row = rows + n_rows++;
+      snprintf(row->pos, sizeof row->pos, "%s:%d", argv[f], line);
+      if (parsing) {
+        check(row->pos, req, &n_valid, &n_mismatches);
+        continue;
+      }
+
+      if (perfting) {
+        struct board board = {0};
+        unsigned int seed;
+        unsigned char prev_move;
+        if (parse(&board, NULL, &seed, &prev_move, req) < 0)
+          fprintf(stderr, "%s: bad request\n", row->pos), exit(EXIT_FAILURE);
+        prepare(&board);
+        long long checked = perft(&board, perfting, true);
+        clock_t start = wall_clock();
+        long long nodes = perft(&board, perfting, false);
+        clock_t time = wall_clock() - start;
+        if (nodes != checked)
+          fprintf(stderr, "%s: perft counts differ\n", row->pos),
+              exit(EXIT_FAILURE);
+        long long micros = (long long)time * 1000000 / CLOCKS_PER_SEC;
+        n_nodes[0] += nodes, n_micros += micros;
+        printf("%s\t%d\t%lld\t%lld\t%lld\n", row->pos, perfting, nodes,
+               micros, nodes * CLOCKS_PER_SEC / (time ? time : 1));
+        fflush(stdout);
+        continue;
+      }
+
+      if (checking) {
+        struct board board = {0};
+        unsigned int seed;
+        unsigned char prev_move;
+        if (parse(&board, NULL, &seed, &prev_move, req) < 0)
+          fprintf(stderr, "%s: bad request\n", row->pos), exit(EXIT_FAILURE);
+        prepare(&board);
+        long long lanes = 0;
+        int mismatches = voronoi(&board, MAX_SNAKES, checking, &lanes);
+        n_nodes[0] += lanes, n_mismatches += mismatches;
+        printf("%s\t%d\t%s\t%lld\t%d\n", row->pos, checking,
+               board.kernel->name, lanes, mismatches);
+        fflush(stdout);
+        continue;
+      }
+
+      char res[1 << 10];
+      char *moves[] = {"left", "right", "down", "up"};
+      if (reduce || brs) {
+        // plain paranoid first, then reduced or Best-Reply
+        struct stats f_stats[2], t_stats[2];
+        struct board board = {0};
+        unsigned int seed;
+        unsigned char prev_move;
+        if (parse(&board, NULL, &seed, &prev_move, req) < 0)
+          fprintf(stderr, "%s: bad request\n", row->pos), exit(EXIT_FAILURE);
+        int snakes = 0;
+        for (int s = 0; s < MAX_SNAKES; s++)
+          snakes += !!board.snakes[s].health;
+        for (int r = 0; r < 2; r++) {
+          struct limits f_limits = fixed, t_limits = timed;
+          f_limits.reduce = t_limits.reduce = r ? reduce : 0;
+          f_limits.brs = t_limits.brs = r ? brs : 0;
+          tt_clear();
+          think(res, sizeof res, req, f_limits, f_stats + r);
+          tt_clear();
+          think(res, sizeof res, req, t_limits, t_stats + r);
+          n_nodes[r] += f_stats[r].nodes;
+        }
+        printf("%s\t%d\t%lld\t%d\t%s\t%lld\t%d\t%s\n", row->pos, snakes,
+               f_stats[0].nodes, t_stats[0].depth, moves[f_stats[0].move],
+               f_stats[1].nodes, t_stats[1].depth, moves[f_stats[1].move]);
+        fflush(stdout);
+        continue;
+      }
+
+      struct stats f_stats, t_stats;
+      tt_clear();
+      if (think(res, sizeof res, req, fixed, &f_stats) < 0)
+        fprintf(stderr, "%s: bad request\n", row->pos), exit(EXIT_FAILURE);
+      tt_clear();
+      clock_t start = wall_clock();
+      think(res, sizeof res, req, timed, &t_stats);
+      clock_t t_time = wall_clock() - start;
+
+      row->depth = f_stats.depth, row->nodes = f_stats.nodes;
+      row->evals = f_stats.evals;
+      snprintf(row->move, sizeof row->move, "%s", moves[f_stats.move]);
+
+      // a position where the game is decided early may not get to `depth`
+      clock_t f_time = f_stats.depth > 0 ? f_stats.time[f_stats.depth] : 1;
+      long long micros = (long long)f_time * 1000000 / CLOCKS_PER_SEC;
+      n_evals += row->evals, n_micros += micros;
+      struct board board = {0};
+      unsigned int seed;
+      unsigned char prev_move;
+      parse(&board, NULL, &seed, &prev_move, req), prepare(&board);
+      k_evals[board.kernel - kernels] += row->evals;
+      k_micros[board.kernel - kernels] += micros;
+      printf("%s\t%d\t%lld\t%lld\t%lld\t%lld\t%s\t%d\t%lld\t%s\n", row->pos,
+             row->depth, row->nodes, row->evals, micros,
+             row->evals * CLOCKS_PER_SEC / (f_time ? f_time : 1), row->move,
+             t_stats.depth,
+             t_stats.evals * CLOCKS_PER_SEC / (t_time ? t_time : 1),
+             moves[t_stats.move]);
+      fflush(stdout);
+
+      struct row *b = base;
+      while (b < base + n_base && strcmp(b->pos, row->pos) != 0)
+        b++;
+      if (baseline && b == base + n_base)
+        fprintf(stderr, "%s: not in baseline\n", row->pos), failed = true;
+      else if (baseline &&
+               (b->depth != row->depth || b->nodes != row->nodes ||
+                b->evals != row->evals || strcmp(b->move, row->move) != 0))
+        fprintf(stderr,
+                "%s: expected %d %lld %lld %s, got %d %lld %lld %s\n",
+                row->pos, b->depth, b->nodes, b->evals, b->move, row->depth,
+                row->nodes, row->evals, row->move),
+            failed = true;
+    }
+  }
+
+  if (parsing) {
+    printf("TOTAL\t\t\t\t%d\t%d\t%d\n", n_rows * FUZZ, n_valid,
+           n_mismatches);
+    if (n_mismatches)
+      fputs("parsers disagree\n", stderr), exit(EXIT_FAILURE);
+    return 0;
+  }
+  if (perfting) {
+    printf("TOTAL\t\t%lld\t%lld\t%lld\n", n_nodes[0], n_micros,
+           n_nodes[0] * 1000000 / (n_micros ? n_micros : 1));
+    return 0;
+  }
+  if (checking) {
+    printf("TOTAL\t\t\t%lld\t%d\n", n_nodes[0], n_mismatches);
+    if (n_mismatches)
+      fputs("kernels disagree\n", stderr), exit(EXIT_FAILURE);
+    return 0;
+  }
+  if (reduce || brs) {
+    printf("TOTAL\t\t%lld\t\t\t%lld\n", n_nodes[0], n_nodes[1]);
+    return 0;
+  }
+
+  printf("TOTAL\t\t\t%lld\t%lld\t%lld\n", n_evals, n_micros,
+         n_evals * 1000000 / (n_micros ? n_micros : 1));
+  printf("\nKERNEL\tEVALS\tMICROS\tEVALS/S\n");
+  for (int k = 0; k < sizeof kernels / sizeof *kernels; k++)
+    if (k_evals[k])
+      printf("%s\t%lld\t%lld\t%lld\n", kernels[k].name, k_evals[k],
+             k_micros[k],
+             k_evals[k] * 1000000 / (k_micros[k] ? k_micros[k] : 1));
+
+  if (output) {
+    FILE *file = fopen(output, "w");
+    if (file == NULL)
+      perror(output), exit(EXIT_FAILURE);
+    fprintf(file, "POS\tDEPTH\tNODES\tEVALS\tMOVE\n");
+    for (struct row *row = rows; row < rows + n_rows; row++)
+      fprintf(file, "%s\t%d\t%lld\t%lld\t%s\n", row->pos, row->depth,
+              row->nodes, row->evals, row->move);
+    fclose(file);
+  }
+
+  if (failed)
+    fputs("search behavior differs from baseline\n", stderr),
+        exit(EXIT_FAILURE);
+}
@@ -0,0 +1,223 @@
+// move.c is included rather than linked, to get at its internals
+#define NO_MAIN
+#include "move.c"
+#include <unistd.h>
+
+// the opening book generator. standard games on 7x7 and 11x11 boards start
+// from the spawn layouts of the standard ruleset: up to four snakes coiled up
+// on the corner points or on the side points, one food diagonal to each of
+// them, away from the center, and one food in the center. every such layout
+// is searched from our point of view with a fresh transposition table, for
+// much longer than a live search gets, and the best move goes into the book,
+// see `book_probe()` in move.c. layouts that are mirror images or rotations of
+// one another are only searched once
+//
+// positions from files of recorded `/move` requests given after the book are
+// searched and added too, which is how later turns get in
+
+// a larger TIME or DEPTH makes for a stronger book but takes longer to build.
+// a larger MAX_ENTRIES allows for larger books
+#define TIME 4000         // default time to search each position, in millis
+#define DEPTH MAX_DEPTH   // default depth to search each position to
+#define SNAKES 4          // default max number of snakes per layout
+#define MAX_ENTRIES 65536 // max number of positions, for allocating buffers
+
+struct book_entry entries[MAX_ENTRIES];
+int n_entries;
+
+int layout(char *buf, size_t size, int width, int n, int points[][2],
+           int food) {
+  // write the `/move` request for the spawn layout of the `n` snakes at
+  // `points`, from the first one's point of view. bit `s` of `food` picks
+  // which of the cells diagonal to snake `s` gets its food. returns -1 if
+  // there's no such choice
+  int center = (width - 1) / 2, foods[MAX_SNAKES + 1][2], n_foods = 0;
+  for (int s = 0; s < n; s++) {
+    int x = points[s][0], y = points[s][1], options[4][2], n_options = 0;
+    for (int d = 0; d < 4; d++) {
+      int fx = x + (d & 1 ? 1 : -1), fy = y + (d & 2 ? 1 : -1);
+      bool away = fx < x && x < center || center < x && x < fx ||
+                  fy < y && y < center || center < y && y < fy;
+      bool corner =
+          (fx == 0 || fx == width - 1) && (fy == 0 || fy == width - 1);
+      if (away && !corner)
+        options[n_options][0] = fx, options[n_options++][1] = fy;
+    }
+    int pick = food >> s & 1;
+    if (pick >= n_options)
+      return -1;
+    foods[n_foods][0] = options[pick][0];
+    foods[n_foods++][1] = options[pick][1];
+  }
+  foods[n_foods][0] = foods[n_foods][1] = center, n_foods++;
+
+  int len = snprintf(buf, size,
+                     "{\"game\":{\"id\":\"book\",\"ruleset\":{\"name\":"
+                     "\"standard\"},\"timeout\":500},\"turn\":0,\"board\":{"
+                     "\"height\":%d,\"width\":%d,\"food\":[",
+                     width, width);
+  for (int f = 0; f < n_foods; f++)
+    len += snprintf(buf + len, size - len, &",{\"x\":%d,\"y\":%d}"[!f],
+                    foods[f][0], foods[f][1]);
+  len += snprintf(buf + len, size - len, "],\"hazards\":[],\"snakes\":[");
+  for (int s = 0; s <= n; s++) {
+    int x = points[s % n][0], y = points[s % n][1];
+    len += snprintf(buf + len, size - len,
+                    "%s{\"id\":\"snake-%d\",\"health\":100,\"length\":3,"
+                    "\"head\":{\"x\":%d,\"y\":%d},\"body\":[{\"x\":%d,"
+                    "\"y\":%d},{\"x\":%d,\"y\":%d},{\"x\":%d,\"y\":%d}]}",
+                    s == n ? "]},\"you\":" : s ? "," : "", s % n, x, y, x, y,
+                    x, y, x, y);
+  }
+  len += snprintf(buf + len, size - len, "}\n");
+  return len < size ? len : -1;
+}
+
+void add(char *pos, char *req, struct limits limits) {
+  // search the position of `req` and add it to the book, unless it or one of
+  // its mirror images is already in it
+  struct board board = {0};
+  unsigned int seed;
+  unsigned char prev_move;
+  if (parse(&board, NULL, &seed, &prev_move, req) < 0)
+    fprintf(stderr, "%s: bad request\n", pos), exit(EXIT_FAILURE);
+  prepare(&board);
+  if (board.rules != RULES_STANDARD || bb_any(board.hazards))
+    return;
+
+  uint64_t key;
+  int sym = book_canon(&board, &key);
+  for (int e = 0; e < n_entries; e++)
+    if (entries[e].key == key)
+      return;
+  if (n_entries == MAX_ENTRIES)
+    fputs("too many positions\n", stderr), exit(EXIT_FAILURE);
+
+  char res[1 << 10];
+  struct stats stats;
+  tt_clear();
+  if (think(res, sizeof res, req, limits, &stats) < 0)
+    fprintf(stderr, "%s: bad request\n", pos), exit(EXIT_FAILURE);
+  if (stats.depth < 0)
+    return; // a single legal move, nothing to look up
+
+  entries[n_entries++] = (struct book_entry){
+      key, stats.eval, book_move(stats.move, sym), stats.depth};
+  printf("%s\t%016" PRIx64 "\t%d\t%+hd\t%s\n", pos, key, stats.depth,
+         stats.eval, (char *[]){"left", "right", "down", "up"}[stats.move]);
+  fflush(stdout);
+}
+
+int compare(const void *a, const void *b) {
+  uint64_t p = ((struct book_entry *)a)->key, q = ((struct book_entry *)b)->key;
+  return (p > q) - (p < q);
+}
+
+int main(int argc, char *argv[]) {
+  int millis = TIME, depth = DEPTH, snakes = SNAKES;
+  for (int opt; (opt = getopt(argc, argv, "t:d:s:")) != -1;)
+    switch (opt) {
+    case 't':
+      millis = atoi(optarg);
+      break;
+    case 'd':
+      depth = atoi(optarg);
+      break;
+    case 's':
+      snakes = atoi(optarg);
+      break;
+    default:
+    usage:
+      fprintf(stderr,
+              "usage: %s [-t millis] [-d depth] [-s snakes] book [file...]\n",
+              *argv);
+      exit(EXIT_FAILURE);
+    }
+  if (optind == argc)
+    goto usage;
+  if (depth < 1 || depth > MAX_DEPTH || millis < 1 || snakes < 2 ||
+      snakes > MAX_SNAKES)
+    fputs("bad depth, time or snakes\n", stderr), exit(EXIT_FAILURE);
+
+  clock_t budget = (clock_t)CLOCKS_PER_SEC * millis / 1000;
+  struct limits limits = {.depth = depth,
+                          .search_time = budget,
+                          .total_time = budget,
+                          .threads = THREADS,
+                          .reduce = REDUCE,
+                          .brs = BRS,
+                          .cold = true,
+                          .quiet = true};
+
+  printf("POS\tKEY\tDEPTH\tEVAL\tMOVE\n");
+  static char req[1 << 16];
+  for (int width = 7; width <= 11; width += 4)
+    for (int n = 2; n <= snakes; n++)
+      for (int sides = 0; sides < 2; sides++)
+        for (int set = 0; set < 16; set++)
+          for (int us = 0; us < 4; us++)
+            for (int food = 0; food < 1 << n; food++) {
+              // the standard ruleset puts up to four snakes either all on
+              // corners or all on sides, and we're the first one
+              int lo = 1, mid = (width - 1) / 2, hi = width - 2;
+              int spawns[2][4][2] = {
+                  {{lo, lo}, {lo, hi}, {hi, lo}, {hi, hi}},
+                  {{lo, mid}, {mid, lo}, {mid, hi}, {hi, mid}}};
+              int points[MAX_SNAKES][2], k = 1;
+              if (__builtin_popcount(set) != n || !(set >> us & 1))
+                continue;
+              points[0][0] = spawns[sides][us][0];
+              points[0][1] = spawns[sides][us][1];
+              for (int p = 0; p < 4; p++)
+                if (p != us && set >> p & 1)
+                  points[k][0] = spawns[sides][p][0],
+                  points[k++][1] = spawns[sides][p][1];
+              if (layout(req, sizeof req, width, n, points, food) < 0)
+                continue;
+              char pos[64];
+              snprintf(pos, sizeof pos, "%dx%d:%d", width, width, n);
+              add(pos, req, limits);
+            }
+
+  // requests from files, found the same way bin/bench finds them
+  for (int f = optind + 1; f < argc; f++) {
+    FILE *file = fopen(argv[f], "r");
+    if (file == NULL)
+      perror(argv[f]), exit(EXIT_FAILURE);
+    static char buf[1 << 24];
+    size_t size = fread(buf, 1, sizeof buf - 1, file);
+    if (ferror(file))
+      perror("fread"), exit(EXIT_FAILURE);
+    if (!feof(file))
+      fputs("file buffer exhausted\n", stderr), exit(EXIT_FAILURE);
+    buf[size] = '\0';
+    fclose(file);
+
+    int line = 1;
+    for (char *p = buf; *p; line += *p++ == '\n') {
+      if (*p != '{' || p != buf && p[-1] != '\n')
+        continue;
+      char *end = jsonw_object(NULL, p);
+      if (end == NULL || !jsonw_lookup("board", jsonw_beginobj(p)))
+        continue;
+      if (end - p >= sizeof req)
+        fputs("request buffer exhausted\n", stderr), exit(EXIT_FAILURE);
+      memcpy(req, p, end - p);
+      req[end - p] = '\0';
+      char pos[256];
+      snprintf(pos, sizeof pos, "%s:%d", argv[f], line);
+      add(pos, req, limits);
+    }
+  }
+
+  qsort(entries, n_entries, sizeof *entries, compare);
+  struct book_header header = {BOOK_MAGIC, book_layout(), n_entries};
+  FILE *file = fopen(argv[optind], "wb");
+  if (file == NULL)
+    perror(argv[optind]), exit(EXIT_FAILURE);
+  if (fwrite(&header, sizeof header, 1, file) != 1 ||
+      fwrite(entries, sizeof *entries, n_entries, file) != n_entries ||
+      fclose(file) != 0)
+    perror(argv[optind]), exit(EXIT_FAILURE);
+  fprintf(stderr, "%d positions\n", n_entries);
+}
@@ -7,8 +7,10 @@
 #define HEAD "sand-worm"
 #define TAIL "round-bum"
 
-int main(void) {
-  printf("Status: 200 OK\nContent-Type: application/json\n\n");
+int info(char *res, size_t size, char *req) {
+  // handle a `/` request. not called `index()` because that name is taken by
+  // <strings.h>. see `move()` in move.c for the calling convention
+  (void)req;
 
   char author[64], color[64], head[64], tail[64];
   if (*jsonw_escape(author, sizeof author, AUTHOR) ||
@@ -17,7 +19,18 @@ int main(void) {
       *jsonw_escape(tail, sizeof tail, TAIL))
     abort();
 
-  printf("{\"apiversion\":\"1\",\"author\":\"%s\","
-         "\"color\":\"%s\",\"head\":\"%s\",\"tail\":\"%s\"}\n",
-         author, color, head, tail);
+  return snprintf(res, size,
+                  "{\"apiversion\":\"1\",\"author\":\"%s\","
+                  "\"color\":\"%s\",\"head\":\"%s\",\"tail\":\"%s\"}\n",
+                  author, color, head, tail);
+}
+
+#ifndef NO_MAIN
+int main(void) {
+  printf("Status: 200 OK\nContent-Type: application/json\n\n");
+
+  char res[1 << 10];
+  info(res, sizeof res, NULL);
+  fputs(res, stdout);
 }
+#endif
@@ -1,29 +1,75 @@
+#define _GNU_SOURCE // for `clock_gettime()`, `open_memstream()` and affinity
 #include "vendor/jsonw.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <setjmp.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 
 // `stdout` is solely for the request response; any logging goes in `stderr`
-// so cgi.conf can redirect it to a file. also, be careful when benchmarking:
-// any modification that changes evals will change what branches get pruned,
-// and that will dominate measurements
+// so cgi.conf can redirect it to a file. when built with `-DNO_MAIN`, there is
+// no `main()` and server.c instead calls `move()` once per request, possibly
+// from several threads at once, so no mutable state may live in globals. also,
+// be careful when benchmarking: any modification that changes evals will
+// change what branches get pruned, and that will dominate measurements. bench.c
+// tells the two apart
 
 // a longer SEARCH_TIME yields better moves but risks hitting the 500ms round-
-// trip timeout. a smaller CHECK_DEPTH cuts off search closer to SEARCH_TIME
-// but impacts performance because of the frequent calls to clock(). a larger
-// MAX_VORONOI assesses boards more accurately but slows down search. a larger
-// MAX_DEPTH is more universal but can cause latency spikes in the endgame. a
-// larger MAX_SNAKES is more flexible but slows down search.
+// trip timeout. a smaller CHECK_NODES cuts off search closer to SEARCH_TIME
+// but impacts performance because of the frequent calls to wall_clock(). a
+// larger MAX_VORONOI assesses boards more accurately but slows down search. a
+// larger MAX_DEPTH is more universal but can cause latency spikes in the
+// endgame. a larger MAX_SNAKES is more flexible but slows down search. a
+// larger THREADS searches deeper so long as there are idle cores to run the
+// threads on, but hurts when concurrent games end up competing for cores. a
+// larger TT_SIZE holds on to more positions but causes more cache misses. a
+// smaller TT_DEPTH saves more nodes but probes the table more often. a larger
+// MAX_NESTING accepts stranger requests but uses more stack to parse them. a
+// narrower ASPIRATION prunes more at the root but fails and re-searches more.
+// a smaller LATENCY_BUCKET gives finer latency histograms. a smaller
+// SOLVE_DEPTH settles separated endgames closer to the leaves but looks for
+// them more often. a larger SOLVE_NODES settles larger regions but wastes more
+// time on those it can't. a larger SOLVE_SIZE remembers more filled regions.
+// a nonzero REDUCE searches deeper in games of three or more snakes, but so
+// far loses more self-play games than it wins, so it's off by default. a
+// nonzero BRS searches deeper still but so far only breaks even, so it's off
+// too. a larger SLACK leaves more of the round trip to replies that have to
+// wait for a core when searches outnumber cores, at the expense of depth.
+// BOOK is generated by bin/book, see book.c, and is only probed if it exists.
 #define TOTAL_TIME 500 / 1000  // game engine's round-trip timeout, in seconds
 #define SEARCH_TIME 400 / 1000 // time at which a search is cut off, in seconds
-#define CHECK_DEPTH 8    // depth above which to check clock() < SEARCH_TIME
-#define MAX_VORONOI 32   // number of Voronoi propagation steps to perform
+#define CHECK_NODES 256  // number of nodes between clock checks
+#define MAX_VORONOI 32   // max number of Voronoi propagation steps to perform
 #define MAX_DEPTH 64     // max search depth, for allocating buffers
 #define MAX_SNAKES 4     // max number of snakes, for allocating buffers
+#define THREADS 4        // number of threads to search with
+#define MAX_GAMES 64     // max number of games to keep state for, for buffers
+#define MAX_NESTING 32   // max nesting of JSON values, for the parser's stack
+#define TT_SIZE (1 << 23) // size of the transposition table, in bytes
+#define TT_DEPTH 2       // depth above which to use the transposition table
+#define ASPIRATION 2     // half-width of the root window, in evals `* 2`
+#define TELEMETRY "telemetry.jsonl" // file to append telemetry to, "" for none
+#define LATENCY_BUCKET 10 // width of latency histogram buckets, in millis
+#define SOLVE_DEPTH 3    // depth from which to look for separated regions
+#define SOLVE_NODES 4096 // max nodes to spend settling separated regions
+#define SOLVE_SIZE (1 << 10) // number of space-filling results to memoize
+#define REDUCE 0         // min distance past which opponents sit out, 0 never
+#define BRS 0            // Best-Reply Search from this many snakes on, 0 never
+#define HAZARD_DAMAGE 14 // health lost per turn in a hazard, by default
+#define SLACK 10         // millis given up per search in excess of the cores
+#define MAX_CORES 64     // max number of cores to schedule searches on
+#define BOOK "book.bin"  // opening book to probe before searching, "" for none
 #define K_OWNED 1        // reward for number of "owned" cells
 #define K_FOOD 1         // reward for number of "owned" food cells
 #define K_LENGTH 4       // reward for being longer than others
@@ -53,8 +99,116 @@ char *jsonw_uchar(unsigned char *num, char *json) {
   return NULL;
 }
 
+#if defined(WIDE)
+// wide bitboards, for boards of more than 128 cells. these are GCC vector
+// extensions, so bitwise operators work on them as usual and codegen into AVX2
+// and friends. shifts and truth tests, however, must go through the `bb_*()`
+// functions below. a 25x25 board needs 10 words, rounded up to a power of two
+#define BB_WORDS 16
+typedef uint64_t bb_t __attribute__((vector_size(BB_WORDS * sizeof(uint64_t))));
+
+bb_t bb_shl(bb_t bb, int n) {
+  // left shift by `n`, where 0 < n < 64. every word is shifted on its own,
+  // then picks up the bits that were shifted out of the word below it
+  bb_t below = __builtin_shuffle(
+      bb, (bb_t){0},
+      (bb_t){16, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14});
+  return bb << n | below >> 64 - n;
+}
+
+bb_t bb_shr(bb_t bb, int n) {
+  // right shift by `n`, where 0 < n < 64. see `bb_shl()`
+  bb_t above = __builtin_shuffle(
+      bb, (bb_t){0},
+      (bb_t){1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16});
+  return bb >> n | above << 64 - n;
+}
+
+bb_t bb_shl_far(bb_t bb, int n) {
+  // left shift by any `n`, as a series of `bb_shl()`s
+  for (; n >= 64; n -= 63)
+    bb = bb_shl(bb, 63);
+  return n ? bb_shl(bb, n) : bb;
+}
+
+bb_t bb_shr_far(bb_t bb, int n) {
+  // right shift by any `n`. see `bb_shl_far()`
+  for (; n >= 64; n -= 63)
+    bb = bb_shr(bb, 63);
+  return n ? bb_shr(bb, n) : bb;
+}
+
+bool bb_any(bb_t bb) {
+  // whether any bit is set
+  uint64_t any = 0;
+  for (int i = 0; i < BB_WORDS; i++)
+    any |= bb[i];
+  return any;
+}
+
+bb_t bb_bit(int i) {
+  // bitboard with only bit `i` set
+  bb_t bb = {0};
+  bb[i / 64] = (uint64_t)1 << i % 64;
+  return bb;
+}
+
+bool bb_get(bb_t bb, int i) {
+  // whether bit `i` is set. a single word, unlike `bb_any(bb & bb_bit(i))`
+  return bb[i / 64] >> i % 64 & 1;
+}
+
+bb_t bb_mask(int n) {
+  // bitboard with the `n` least significant bits set
+  bb_t bb = {0};
+  for (int i = 0; i < BB_WORDS; i++)
+    bb[i] = n >= 64 * (i + 1) ? -1 : n > 64 * i ? ~(-1ull << n % 64) : 0;
+  return bb;
+}
+
+int bb_popcnt(bb_t bb) {
+  int pop = 0;
+  for (int i = 0; i < BB_WORDS; i++)
+    pop += __builtin_popcountll(bb[i]);
+  return pop;
+}
+
+int bb_ctz(bb_t bb) {
+  // index of the least significant set bit
+  int i = 0;
+  while (i < BB_WORDS - 1 && !bb[i])
+    i++;
+  return i * 64 + __builtin_ctzll(bb[i]);
+}
+
+uint64_t bb_hash(bb_t bb, uint64_t hash) {
+  // mix the bitboard into `hash`, for memoization
+  for (int i = 0; i < BB_WORDS; i++)
+    hash = (hash ^ bb[i]) * 0x9e3779b97f4a7c15, hash ^= hash >> 32;
+  return hash;
+}
+
+bb_t bb_dump(bb_t bb) {
+  for (int i = BB_WORDS; i--;)
+    fprintf(stderr, "%016" PRIxLEAST64, (uint_least64_t)bb[i]);
+  fputc('\n', stderr);
+  return bb;
+}
+#else
 typedef uint128_t bb_t; // bitboard
 
+// these only exist so that the code is generic over the bitboard width. with
+// a `uint128_t` they compile down to the plain operators
+
+bb_t bb_shl(bb_t bb, int n) { return bb << n; }
+bb_t bb_shr(bb_t bb, int n) { return bb >> n; }
+bb_t bb_shl_far(bb_t bb, int n) { return bb << n; }
+bb_t bb_shr_far(bb_t bb, int n) { return bb >> n; }
+bool bb_any(bb_t bb) { return bb != 0; }
+bb_t bb_bit(int i) { return (bb_t)1 << i; }
+bool bb_get(bb_t bb, int i) { return bb >> i & 1; }
+bb_t bb_mask(int n) { return n ? (bb_t)-1 >> 128 - n : 0; }
+
 int bb_popcnt(bb_t bb) {
   // codegens into a pair of `popcnt` instructions
   int pop = 0;
@@ -63,11 +217,27 @@ int bb_popcnt(bb_t bb) {
   return pop;
 }
 
+int bb_ctz(bb_t bb) {
+  // index of the least significant set bit. codegens into a pair of `popcnt`
+  // instructions, same as `bb_popcnt()`
+  return bb_popcnt(~bb & bb - 1);
+}
+
+uint64_t bb_hash(bb_t bb, uint64_t hash) {
+  // mix the bitboard into `hash`, for memoization
+  hash = (hash ^ (uint64_t)bb) * 0x9e3779b97f4a7c15, hash ^= hash >> 32;
+  hash = (hash ^ (uint64_t)(bb >> 64)) * 0x9e3779b97f4a7c15;
+  return hash ^ hash >> 32;
+}
+
 bb_t bb_dump(bb_t bb) {
   fprintf(stderr, "%016" PRIxLEAST64 "%016" PRIxLEAST64 "\n",
           (uint_least64_t)(bb >> 64), (uint_least64_t)(bb & (bb_t)-1 >> 64));
   return bb;
 }
+#endif
+
+#define CELLS (sizeof(bb_t) * CHAR_BIT)
 
 struct snake {
   // making the head and tail `unsigned char`s doesn't improve performance and
@@ -80,13 +250,28 @@ struct snake {
   bb_t body, axis, sign;
   unsigned char length, health;
   unsigned char taillag; // number of turns to wait before moving the tail
+  bool frozen; // sits out the current turn for being far away. see `turn()`
 };
 
+struct kernel;
+
+// rulesets, by `game.ruleset.name`. the search only knows about the ways they
+// differ in how snakes move, and plays any other ruleset as standard
+#define RULES_STANDARD 0
+#define RULES_WRAPPED 1     // moving off an edge comes back in at the other
+#define RULES_ROYALE 2      // heads in hazards lose extra health
+#define RULES_CONSTRICTOR 3 // every snake grows and heals on every move
+char *rulesets[] = {"standard", "wrapped", "royale", "constrictor"};
+
 struct board {
   struct snake snakes[MAX_SNAKES];
   // `food` holds the cells with food and `heads` holds the heads of all snakes
   // that haven't yet moved on the current turn
   bb_t food, heads;
+  // union of the bodies of all live snakes, so a collision is a single test.
+  // kept up to date by the helpers that make and unmake moves, see
+  // `move_body()`
+  bb_t bodies;
   // these two bitboards they are initialized once and never modified again.
   // `board` is a bit mask that contains every cell of the board, so we can mask
   // out excess bits in a `bb_t` that are outside the board. `xmask` is the same
@@ -94,33 +279,100 @@ struct board {
   // out bits that would wrap around horizontally when shifting by 1
   bb_t board, xmask;
   unsigned char width, height;
+  // `RULES_*`, see `adj_kernel()` and `step_kernel()`. `hazards` holds the
+  // cells with hazards, which only matter under royale rules
+  unsigned char rules, hazard_damage;
+  bb_t hazards;
+  // Zobrist hash of the heads, bodies and food, kept up to date by
+  // `step_kernel()` and `turn()` as they flip bits. see `zobrist_hash()`
+  uint64_t hash;
+  // eval kernels for this board size, picked once when parsing. see `kernels`
+  struct kernel *kernel;
 };
 
+#if defined(__GNUC__) // so constant arguments fold into immediates
+#define KERNEL static inline __attribute__((always_inline))
+#else
+#define KERNEL static inline
+#endif
+
+KERNEL bb_t adj_kernel(int rules, bb_t bb, struct board *board) {
+  // union of the bitboard shifted once in each cardinal direction. on wrapped
+  // boards, cells on an edge are also adjacent to those across the board,
+  // which are a rotation of the row or of the whole board away. callers pass
+  // `rules` as a constant, so standard rules pay nothing for it
+  bb_t a = bb_shr(bb & board->xmask, 1) | bb_shl(bb, 1) & board->xmask |
+           bb_shr(bb, board->width) | bb_shl(bb, board->width) & board->board;
+  if (rules == RULES_WRAPPED) {
+    int w = board->width, far = w * (board->height - 1);
+    bb_t left = board->board & ~board->xmask, bottom = bb_mask(w);
+    a |= bb_shl(bb & left, w - 1) | bb_shr(bb, w - 1) & left |
+         bb_shl_far(bb & bottom, far) | bb_shr_far(bb, far);
+  }
+  return a;
+}
+
 bb_t adj(bb_t bb, struct board *board) {
-  // union of the bitboard shifted once in each cardinal direction
-  return (bb & board->xmask) >> 1 | bb << 1 & board->xmask |
-         bb >> board->width | bb << board->width & board->board;
+  // `adj_kernel()`, for code off the hot path
+  return board->rules == RULES_WRAPPED ? adj_kernel(RULES_WRAPPED, bb, board)
+                                       : adj_kernel(RULES_STANDARD, bb, board);
+}
+
+KERNEL bool outside(int rules, int cell, int move, struct board *board) {
+  // whether `move` takes a head at `cell` off the board. `xmask` has a bit for
+  // every cell off the left edge, and a cell is on the right edge if the cell
+  // `width - 1` before it is on the left edge
+  int w = board->width;
+  return rules != RULES_WRAPPED &&
+         (move == 0   ? !bb_get(board->xmask, cell)
+          : move == 1 ? cell >= w - 1 && !bb_get(board->xmask, cell - w + 1)
+          : move == 2 ? cell < w
+                      : cell >= w * (board->height - 1));
+}
+
+KERNEL bb_t shift(int rules, bb_t bb, int move, struct board *board) {
+  // move the single cell `bb` by `move`, which mustn't take it `outside()`
+  // the board. see `adj_kernel()` for wrapped boards
+  bool axis = move >> 1, sign = move & 1;
+  if (rules == RULES_WRAPPED) {
+    int w = board->width, far = w * (board->height - 1);
+    bb_t left = board->board & ~board->xmask, bottom = bb_mask(w);
+    return move == 0   ? bb_shr(bb & board->xmask, 1) | bb_shl(bb & left, w - 1)
+           : move == 1 ? bb_shl(bb, 1) & board->xmask | bb_shr(bb, w - 1) & left
+           : move == 2 ? bb_shr(bb, w) | bb_shl_far(bb & bottom, far)
+                       : bb_shl(bb, w) & board->board | bb_shr_far(bb, far);
+  }
+  return sign ? bb_shl(bb, axis ? board->width : 1)
+              : bb_shr(bb, axis ? board->width : 1);
+}
+
+KERNEL void drain(int rules, struct snake *snake, struct board *board,
+                  bb_t food) {
+  // take a move's worth of health from a snake whose head has just moved: one,
+  // plus hazard damage under royale rules, unless it's about to eat
+  snake->health--;
+  if (rules == RULES_ROYALE && bb_any(snake->head & board->hazards & ~food))
+    snake->health = snake->health > board->hazard_damage
+                        ? snake->health - board->hazard_damage
+                        : 0;
 }
 
 #define EVAL_MIN (SHRT_MIN / 2)
 #define EVAL_MAX (SHRT_MAX / 2)
 #define EVAL_ZERO 0
 
-int n_evals = 0;
-short eval(struct board *board) {
-  n_evals++;
+KERNEL void eval_seed(int rules, struct board *board, bb_t *bodies,
+                      bb_t *owned, bb_t *lost) {
+  // first stage of `eval()`: find the obstacles and the initial frontiers
 
   // note that the tail of every snake is removed at the beginning of each turn,
   // so there is no need to correct for anything here
-  bb_t bodies = 0;
-  for (int s = 0; s < MAX_SNAKES; s++)
-    if (board->snakes[s].health)
-      bodies |= board->snakes[s].body;
+  *bodies = board->bodies;
 
   // Voronoi heuristic. 'owned' cells we can reach strictly before anyone else
   // and 'lost' cells we cannot
 
-  bb_t owned = board->snakes->head, lost = 0;
+  *owned = board->snakes->head, *lost = (bb_t){0};
   for (int s = 1; s < MAX_SNAKES; s++) {
     if (!board->snakes[s].health)
       continue;
@@ -128,23 +380,178 @@ short eval(struct board *board) {
     bb_t temp = board->snakes[s].head;
 
     // step the snakes that haven't yet moved this turn
-    if (board->snakes[s].head & board->heads)
-      temp |= adj(temp, board) & ~bodies;
+    if (bb_any(board->snakes[s].head & board->heads))
+      temp |= adj_kernel(rules, temp, board) & ~*bodies;
     // step the snakes that are at least as long as us, because they would kill
     // us in a head-to-head collision
     if (board->snakes[s].length >= board->snakes->length)
-      temp |= adj(temp, board) & ~bodies;
+      temp |= adj_kernel(rules, temp, board) & ~*bodies;
+
+    *lost |= temp;
+  }
+}
+
+KERNEL void fill_kernel(bb_t bodies, bb_t *owned, bb_t *lost, int w,
+                        bb_t board, bb_t xmask) {
+  // propagation is deterministic, so once a step changes neither `owned` nor
+  // `lost`, no later step will either and the remaining steps can be skipped
+  for (int i = 0; i < MAX_VORONOI; i++) {
+    bb_t o = *owned, l = *lost, a;
+    a = bb_shr(o & xmask, 1) | bb_shl(o, 1) & xmask | bb_shr(o, w) |
+        bb_shl(o, w) & board;
+    *owned |= a & ~bodies & ~l;
+    a = bb_shr(l & xmask, 1) | bb_shl(l, 1) & xmask | bb_shr(l, w) |
+        bb_shl(l, w) & board;
+    *lost |= a & ~bodies & ~*owned;
+    if (!bb_any(*owned ^ o | *lost ^ l))
+      break;
+  }
+}
+
+#if defined(__GNUC__) && !defined(WIDE) // vector extensions, as for `bb_t`
+typedef uint64_t bb4_t __attribute__((vector_size(4 * sizeof(uint64_t))));
+
+struct bb4 {
+  // four bitboards as a structure of arrays: lane `m` of `lo` and `hi` holds
+  // the low and high halves of bitboard `m`, so that 128-bit shifts become
+  // lanewise 64-bit shifts plus carries from `lo` into `hi` or vice versa
+  bb4_t lo, hi;
+};
+
+KERNEL struct bb4 adj4(struct bb4 bb, uint64_t x_lo, uint64_t x_hi,
+                       uint64_t b_lo, uint64_t b_hi, int w) {
+  // same as `adj()`, for shifts by `w` where 0 < w < 64
+  bb4_t r_lo = bb.lo & x_lo, r_hi = bb.hi & x_hi;
+  return (struct bb4){
+      r_lo >> 1 | r_hi << 63 | bb.lo << 1 & x_lo | bb.lo >> w |
+          bb.hi << 64 - w | bb.lo << w & b_lo,
+      r_hi >> 1 | (bb.hi << 1 | bb.lo >> 63) & x_hi | bb.hi >> w |
+          (bb.hi << w | bb.lo >> 64 - w) & b_hi};
+}
+
+KERNEL void fill4_kernel(bb_t bodies[4], bb_t owned[4], bb_t lost[4], int w,
+                         bb_t board, bb_t xmask) {
+  // `fill_kernel()` four boards at once, for 0 < w < 64. the boards must all
+  // share the same dimensions, which is the case for the children of a node
+  struct bb4 b, o, l;
+  for (int m = 0; m < 4; m++) {
+    b.lo[m] = ~bodies[m], b.hi[m] = ~bodies[m] >> 64;
+    o.lo[m] = owned[m], o.hi[m] = owned[m] >> 64;
+    l.lo[m] = lost[m], l.hi[m] = lost[m] >> 64;
+  }
+
+  uint64_t x_lo = xmask, x_hi = xmask >> 64;
+  uint64_t b_lo = board, b_hi = board >> 64;
+  for (int i = 0; i < MAX_VORONOI; i++) {
+    struct bb4 o0 = o, l0 = l;
+    struct bb4 a = adj4(o, x_lo, x_hi, b_lo, b_hi, w);
+    o.lo |= a.lo & b.lo & ~l.lo, o.hi |= a.hi & b.hi & ~l.hi;
+    a = adj4(l, x_lo, x_hi, b_lo, b_hi, w);
+    l.lo |= a.lo & b.lo & ~o.lo, l.hi |= a.hi & b.hi & ~o.hi;
+    // stop once all four lanes have reached their fixpoint
+    bb4_t d = o.lo ^ o0.lo | o.hi ^ o0.hi | l.lo ^ l0.lo | l.hi ^ l0.hi;
+    if (!(d[0] | d[1] | d[2] | d[3]))
+      break;
+  }
+
+  for (int m = 0; m < 4; m++) {
+    owned[m] = (bb_t)o.hi[m] << 64 | o.lo[m];
+    lost[m] = (bb_t)l.hi[m] << 64 | l.lo[m];
+  }
+}
+#else
+KERNEL void fill4_kernel(bb_t bodies[4], bb_t owned[4], bb_t lost[4], int w,
+                         bb_t board, bb_t xmask) {
+  for (int m = 0; m < 4; m++)
+    fill_kernel(bodies[m], owned + m, lost + m, w, board, xmask);
+}
+#endif
 
-    lost |= temp;
+// second stage of `eval()`: perform Voronoi propagation steps. this is by far
+// the hottest part of the program, as confirmed by profiling. notice that its
+// time complexity is constant in the number of snakes. there is one variant
+// per common board size, in which the shift amounts and masks are immediates,
+// plus a generic variant for every other size and one for wrapped boards.
+// `fill4` does the same as `fill` on four boards at once. the largest boards
+// that fit in 128 bits, 16x8 and 8x16, get a variant too, whose `board` mask
+// is every bit. wide bitboards only get the generic variants
+
+#if !defined(WIDE)
+// `board` and `xmask` for a board of a given size. when `W` and `H` are
+// constants, so are these
+#define BB_BOARD(W, H) ((bb_t)-1 >> 128 - (W) * (H))
+#define BB_XMASK(W, H)                                                         \
+  (BB_BOARD(W, H) & ~(BB_BOARD(W, H) / ((bb_t)-1 >> 128 - (W))))
+
+// `fill_WxH()` and `fill4_WxH()`, for a board of a given size
+#define FILL(W, H)                                                             \
+  void fill_##W##x##H(struct board *board, bb_t bodies, bb_t *owned,           \
+                      bb_t *lost) {                                            \
+    (void)board, fill_kernel(bodies, owned, lost, W, BB_BOARD(W, H),           \
+                             BB_XMASK(W, H));                                  \
+  }                                                                            \
+  void fill4_##W##x##H(struct board *board, bb_t bodies[4], bb_t owned[4],     \
+                       bb_t lost[4]) {                                         \
+    (void)board, fill4_kernel(bodies, owned, lost, W, BB_BOARD(W, H),          \
+                              BB_XMASK(W, H));                                 \
   }
 
-  // perform Voronoi propagation steps. this is by far the hottest part of the
-  // program, as confirmed by profiling. notice that its time complexity is
-  // constant in the number of snakes
+FILL(7, 7)
+FILL(11, 11)
+FILL(16, 8)
+FILL(8, 16)
+#endif
+
+void fill_any(struct board *board, bb_t bodies, bb_t *owned, bb_t *lost) {
+  fill_kernel(bodies, owned, lost, board->width, board->board, board->xmask);
+}
+void fill4_any(struct board *board, bb_t bodies[4], bb_t owned[4],
+               bb_t lost[4]) {
+  if (board->width < 64)
+    fill4_kernel(bodies, owned, lost, board->width, board->board,
+                 board->xmask);
+  else
+    for (int m = 0; m < 4; m++)
+      fill_any(board, bodies[m], owned + m, lost + m);
+}
+
+void fill_wrapped(struct board *board, bb_t bodies, bb_t *owned, bb_t *lost) {
+  // `fill_kernel()` for wrapped boards of any size, whose frontiers spill over
+  // the edges
   for (int i = 0; i < MAX_VORONOI; i++) {
-    owned |= adj(owned, board) & ~bodies & ~lost;
-    lost |= adj(lost, board) & ~bodies & ~owned;
+    bb_t o = *owned, l = *lost;
+    *owned |= adj_kernel(RULES_WRAPPED, o, board) & ~bodies & ~l;
+    *lost |= adj_kernel(RULES_WRAPPED, l, board) & ~bodies & ~*owned;
+    if (!bb_any(*owned ^ o | *lost ^ l))
+      break;
   }
+}
+void fill4_wrapped(struct board *board, bb_t bodies[4], bb_t owned[4],
+                   bb_t lost[4]) {
+  for (int m = 0; m < 4; m++)
+    fill_wrapped(board, bodies[m], owned + m, lost + m);
+}
+
+struct kernel {
+  char *name;
+  bool wrapped;                // for wrapped boards rather than others
+  unsigned char width, height; // 0 for any
+  void (*fill)(struct board *board, bb_t bodies, bb_t *owned, bb_t *lost);
+  void (*fill4)(struct board *board, bb_t bodies[4], bb_t owned[4],
+                bb_t lost[4]);
+} kernels[] = {
+#if !defined(WIDE)
+    {"7x7", false, 7, 7, fill_7x7, fill4_7x7},
+    {"11x11", false, 11, 11, fill_11x11, fill4_11x11},
+    {"16x8", false, 16, 8, fill_16x8, fill4_16x8},
+    {"8x16", false, 8, 16, fill_8x16, fill4_8x16},
+#endif
+    {"wrapped", true, 0, 0, fill_wrapped, fill4_wrapped},
+    {"any", false, 0, 0, fill_any, fill4_any}};
+
+KERNEL short eval_score(int rules, struct board *board, bb_t owned,
+                        bb_t lost) {
+  // third stage of `eval()`: count cells and combine with other metrics
 
   // if we own a cell adjacent to a snake's tail, it's probable we could follow
   // that tail for a while, so guess that we own about half that snake's body.
@@ -153,11 +560,14 @@ short eval(struct board *board) {
   for (int s = 0; s < MAX_SNAKES; s++) {
     if (!board->snakes[s].health)
       continue;
-    if (adj(owned, board) & board->snakes[s].tail)
+    if (bb_any(adj_kernel(rules, owned, board) & board->snakes[s].tail))
       n_owned += bb_popcnt(board->snakes[s].body) / 2;
-    if (adj(lost, board) & board->snakes[s].tail)
+    if (bb_any(adj_kernel(rules, lost, board) & board->snakes[s].tail))
       n_lost += bb_popcnt(board->snakes[s].body) / 2;
   }
+  // hazards eat away at whoever stays in them, so they're only worth so much
+  if (rules == RULES_ROYALE)
+    n_owned -= bb_popcnt(owned & board->hazards) / 2;
 
   // combine the Voronoi heuristic with other metrics to produce a board eval
   short eval =
@@ -171,18 +581,620 @@ short eval(struct board *board) {
   return eval;
 }
 
+KERNEL short eval(int rules, struct board *board) {
+  bb_t bodies, owned, lost;
+  eval_seed(rules, board, &bodies, &owned, &lost);
+  board->kernel->fill(board, bodies, &owned, &lost);
+  return eval_score(rules, board, owned, lost);
+}
+
 struct best {
   short eval;
   unsigned char move;
 };
 
-struct best turn(clock_t cutoff, jmp_buf abort /* to abort a search */,
-                 struct board *board /* modified in-place then restored */,
-                 short (*evals)[4] /* a cache for iterative deepening */,
-                 short alpha, short beta, int depth);
+clock_t wall_clock(void) {
+  // `clock()` measures the CPU time of the whole process, which is meaningless
+  // once a search is spread over several threads or several searches run
+  // concurrently in server mode. the game engine's timeout is in wall time
+  // anyway, so measure that instead, in the same `CLOCKS_PER_SEC` units
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+    abort();
+  return (clock_t)ts.tv_sec * CLOCKS_PER_SEC +
+         (clock_t)ts.tv_nsec * CLOCKS_PER_SEC / 1000000000;
+}
 
-struct best step(int s, clock_t cutoff, jmp_buf abort, struct board *board,
-                 short (*evals)[4], short alpha, short beta, int depth) {
+// Zobrist hashing: every (snake, cell) pair gets a random key for heads and one
+// for bodies, and every cell gets one for food. a board's hash is the XOR of
+// the keys of the bits that are set, so flipping a bit is a single XOR. the
+// snake about to move, snakes marked as dead and the opponent replying in
+// Best-Reply Search get keys too, since they make otherwise-identical boards
+// play out differently. so do opponents sitting out a turn and the REDUCE
+// distance a search was started with, see `turn()`. the transposition table
+// is shared by games of every ruleset, so rulesets other than standard get a
+// key, mixed with the hazards, which don't change during a search. `axis`,
+// `sign`, `taillag` and `health` are left out: boards that differ only there
+// are rare enough, and hashing them would mean rehashing on every step
+
+struct zobrist {
+  uint64_t head[MAX_SNAKES][CELLS], body[MAX_SNAKES][CELLS], food[CELLS];
+  uint64_t mover[MAX_SNAKES], dead[MAX_SNAKES];
+  uint64_t replier[MAX_SNAKES];
+  uint64_t rules[sizeof rulesets / sizeof *rulesets];
+  uint64_t frozen[MAX_SNAKES], reduce[CELLS];
+} zobrist;
+pthread_once_t zobrist_once = PTHREAD_ONCE_INIT;
+
+void zobrist_init(void) {
+  // splitmix64, seeded with a constant so that hashes are reproducible
+  uint64_t state = 0;
+  for (uint64_t *key = (uint64_t *)&zobrist;
+       key < (uint64_t *)(&zobrist + 1); key++) {
+    uint64_t z = state += 0x9e3779b97f4a7c15;
+    z = (z ^ z >> 30) * 0xbf58476d1ce4e5b9;
+    z = (z ^ z >> 27) * 0x94d049bb133111eb;
+    *key = z ^ z >> 31;
+  }
+}
+
+uint64_t zobrist_hash(struct board *board) {
+  // hash a board from scratch. `step_kernel()` and `turn()` update hashes
+  // incrementally instead, so this is only needed once per request
+  uint64_t hash = 0;
+  for (int s = 0; s < MAX_SNAKES; s++) {
+    if (!board->snakes[s].health)
+      continue;
+    hash ^= zobrist.head[s][bb_ctz(board->snakes[s].head)];
+    for (bb_t body = board->snakes[s].body; bb_any(body);) {
+      int cell = bb_ctz(body);
+      hash ^= zobrist.body[s][cell], body &= ~bb_bit(cell);
+    }
+  }
+  for (bb_t food = board->food; bb_any(food);) {
+    int cell = bb_ctz(food);
+    hash ^= zobrist.food[cell], food &= ~bb_bit(cell);
+  }
+  if (board->rules != RULES_STANDARD)
+    hash ^= bb_hash(board->hazards, zobrist.rules[board->rules]);
+  return hash;
+}
+
+// transposition table: a fixed-size hash table of search results, shared by
+// all threads and all concurrent searches. buckets are one cache line each so
+// that a probe costs at most one cache miss. entries are written to and read
+// from without locks; `check` is `key ^ data`, so an entry torn by concurrent
+// writes fails verification and reads as a miss instead of as garbage
+
+#define TT_LOWER 1 // eval is a lower bound, the search failed high
+#define TT_UPPER 2 // eval is an upper bound, the search failed low
+#define TT_EXACT 3 // eval is exact
+
+struct entry {
+  // `data` packs, from least to most significant byte, the eval (two bytes),
+  // the depth, the bound, the best move and the generation. all zeros means
+  // the entry is empty, since a bound is never zero
+  _Atomic uint64_t check, data;
+};
+
+struct bucket {
+  _Alignas(64) struct entry entries[64 / sizeof(struct entry)];
+} tt[TT_SIZE / sizeof(struct bucket)];
+
+// incremented once per search so that entries from past searches get replaced
+// before entries from the current one
+atomic_uchar tt_generation;
+
+uint64_t tt_probe(uint64_t key) {
+  struct bucket *bucket = tt + key % (sizeof tt / sizeof *tt);
+  for (int e = 0; e < sizeof bucket->entries / sizeof *bucket->entries; e++) {
+    struct entry *entry = bucket->entries + e;
+    uint64_t data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+    if ((atomic_load_explicit(&entry->check, memory_order_relaxed) ^ data) ==
+            key &&
+        data)
+      return data;
+  }
+  return 0;
+}
+
+void tt_clear(void) {
+  // forget everything, for reproducible searches. only call this while no
+  // search is running
+  memset(tt, 0, sizeof tt);
+}
+
+void tt_store(uint64_t key, short eval, int depth, int bound,
+              unsigned char move) {
+  struct bucket *bucket = tt + key % (sizeof tt / sizeof *tt);
+  unsigned char generation =
+      atomic_load_explicit(&tt_generation, memory_order_relaxed);
+
+  // overwrite the entry for the same position if there is one. otherwise,
+  // replace the shallowest entry, preferring entries from past searches
+  struct entry *victim = bucket->entries;
+  int victim_score = INT_MAX;
+  for (int e = 0; e < sizeof bucket->entries / sizeof *bucket->entries; e++) {
+    struct entry *entry = bucket->entries + e;
+    uint64_t data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+    if ((atomic_load_explicit(&entry->check, memory_order_relaxed) ^ data) ==
+        key) {
+      victim = entry;
+      break;
+    }
+    int score = (data >> 16 & 0xff) + ((data >> 40 & 0xff) == generation) * 256;
+    if (score < victim_score)
+      victim = entry, victim_score = score;
+  }
+
+  uint64_t data = (uint16_t)eval | (uint64_t)depth << 16 |
+                  (uint64_t)bound << 24 | (uint64_t)move << 32 |
+                  (uint64_t)generation << 40;
+  atomic_store_explicit(&victim->check, key ^ data, memory_order_relaxed);
+  atomic_store_explicit(&victim->data, data, memory_order_relaxed);
+}
+
+// Lazy SMP: every thread runs its own iterative deepening over its own copy of
+// the board and its own `evals` cache, seeded differently so threads explore
+// the tree in different orders. whichever thread completes a depth first
+// publishes its result in `struct shared`, and threads still searching that
+// depth or a shallower one abandon it and move on to the next. odd-numbered
+// threads search one ply deeper than even-numbered ones so that threads are
+// spread over two depths at any given time
+
+// limits on a search. `move()` takes them from the knobs at the top of this
+// file, and bin/bench overrides them to measure search performance
+struct limits {
+  clock_t arrival; // `wall_clock()` time the request arrived at, or 0 for now
+  int depth;                       // max depth to search to, up to MAX_DEPTH
+  clock_t search_time, total_time; // see SEARCH_TIME and TOTAL_TIME
+  int threads;                     // number of threads, up to THREADS
+  int reduce;                      // see REDUCE
+  int brs;                         // see BRS, 0 never
+  bool schedule; // share the cores with concurrent searches, see `scheduler`
+  uint64_t cores; // cores the threads are pinned to, one bit each, 0 for any
+  int queue;      // searches in flight when this one was admitted, itself too
+  bool cold;  // neither use nor update the state carried over between turns
+  bool ponder; // keep searching after the reply, see `ponder_start()`
+  bool quiet; // don't log anything to `stderr`
+  bool book;  // reply from the opening book if it has the position, see BOOK
+  bool scale; // scale the times to the request's `game.timeout`, if it has one
+};
+
+// what a search did, for bin/bench. counts cover every thread
+struct stats {
+  int depth; // deepest depth completed, or -1 if none
+  unsigned char move;
+  short eval; // root eval of `move`
+  long long nodes, evals, betas;
+  clock_t time[MAX_DEPTH + 1]; // `wall_clock()` time to complete each depth
+  long long depth_nodes[MAX_DEPTH + 1]; // nodes searched by then, 0 if skipped
+  // whether the previous turn was pondered and whether that paid off, and by
+  // how many depths pondering got past the previous reply
+  bool pondered, hit;
+  int gained;
+  int threads; // number of threads that actually ran
+  bool booked; // the move came from the opening book rather than a search
+  bool forced; // the move was the only legal one, so there was no search
+};
+
+struct shared {
+  // everything but `depth` and `stop` is protected by `mutex`
+  pthread_mutex_t mutex;
+  atomic_int depth; // deepest depth completed so far by any thread, or -1
+  int warm; // depth to carry on from when warm-starting, see `think()`
+  atomic_bool stop; // set once the search is over, to stop the other threads
+  unsigned char move, prev_move;
+  unsigned char only; // the one root move to search, or 4 for all of them
+  int partial_depth; // depth of the aborted iteration `move` comes from, if any
+  short root_evals[4];
+  unsigned char pv[MAX_DEPTH];
+  int pv_len;
+  struct board board; // pristine copy, to restore boards after an abort
+  clock_t start, prev;
+  clock_t done[MAX_DEPTH + 1]; // `wall_clock()` at which each depth completed
+  long long nodes[MAX_DEPTH + 1]; // nodes all threads had searched by then
+  clock_t predicted; // predicted completion of the iteration not started
+  FILE *log;
+  struct search *searches;
+  int threads;
+  struct limits limits;
+};
+
+// counters that `step_kernel()` only keeps for logs and telemetry. building
+// with `-DNO_COUNTERS` takes them off the hot path, and they then read as 0
+#if defined(NO_COUNTERS)
+#define STAT(...) ((void)0)
+#else
+#define STAT(...) (__VA_ARGS__)
+#endif
+
+// scheduler: when several games are searched at once, each search gets a
+// share of the cores rather than assuming it owns THREADS of them, and its
+// threads are pinned to cores no other search is using, so concurrent searches
+// neither fight over cores nor all time out together. see `sched_admit()`
+struct scheduler {
+  pthread_mutex_t mutex; // protects `busy`
+  int cores;             // number of cores we're allowed to run on
+  int cpus[MAX_CORES];   // the CPU number of each core
+  uint64_t busy;         // cores claimed by searches, one bit each
+  atomic_int searches;   // searches in flight, pinned or not
+  atomic_int pondering;  // threads pondering, which run on whatever is free
+  atomic_int preempted;  // ponders stopped early to make room for searches
+} scheduler = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+pthread_once_t scheduler_once = PTHREAD_ONCE_INIT;
+
+struct search {
+  struct shared *shared;
+  pthread_t thread;
+  int depth;      // depth of the current iteration
+  clock_t cutoff; // `wall_clock()` value past which to abort the search
+  unsigned char partial; // best root move so far in the current iteration
+  jmp_buf abort;  // to abort an iteration
+  // number of calls to `eval()`, for logging. only ever written to by the
+  // thread that owns it, so a relaxed load and store is enough to increment it
+  atomic_int n_evals;
+  // calls to `step_kernel()` that don't just return an eval. same as above
+  atomic_int n_nodes;
+  // transposition table stats, for logging. see `tt_probe()`
+  int n_probes, n_hits, n_cutoffs;
+  // separated region stats, for logging: nodes where every snake seemed to be
+  // walled off and those `endgame()` could settle. see `solve()`
+  int n_regions, n_settled;
+  // turns an opponent sat out for being too far away, for logging
+  int n_reduced;
+  // opponent replying this turn in Best-Reply Search, see
+  // `best_reply_kernel()`. -1 if it hasn't been picked yet or 0 for none, as
+  // every opponent branches
+  int replier;
+  // principal variation search stats, for logging. read by other threads, so
+  // same as above: aspiration window fail-highs and fail-lows at the root, and
+  // null-window searches that had to be redone with the full window
+  atomic_int n_highs, n_lows, n_researches;
+  // move ordering stats, for logging: nodes where a move caused a beta cutoff,
+  // those where it was the first move searched, and total moves searched
+  int n_betas, n_firsts, n_children;
+  // move ordering heuristics, see `step_kernel()`. `killers[ply]` is the last
+  // move to cause a beta cutoff at `ply`. `history[s][cell][move]` is how often
+  // and how deep `move` by snake `s` from `cell` caused a beta cutoff, decayed
+  // over the iterations
+  unsigned char killers[MAX_DEPTH + 1];
+  int history[MAX_SNAKES][CELLS][4];
+  // triangular principal variation table: `pv[ply]` holds, from index `ply` up
+  // to `pv_len[ply]`, the best line found by the node at that ply
+  unsigned char pv[MAX_DEPTH + 1][MAX_DEPTH];
+  int pv_len[MAX_DEPTH + 1];
+  struct board board;
+  short evals[MAX_DEPTH][4];
+  // memoized results of `solve()`. `exact` is false if the search stopped at
+  // `turns` moves because that was all that was asked for. `turns` is -1 for
+  // boards `endgame()` couldn't settle
+  struct solved {
+    uint64_t key;
+    short turns;
+    bool exact;
+  } solved[SOLVE_SIZE];
+};
+
+void count(atomic_int *counter) {
+  // increment a counter that is only ever written to by one thread. a relaxed
+  // load and store is enough and avoids the cost of a locked increment
+  atomic_store_explicit(
+      counter, atomic_load_explicit(counter, memory_order_relaxed) + 1,
+      memory_order_relaxed);
+}
+
+bb_t region(struct board *board, bb_t from, bb_t walls) {
+  // cells reachable from `from` without going through `walls`
+  for (bb_t prev = {0}; bb_any(from ^ prev);)
+    prev = from, from |= adj(from, board) & ~walls;
+  return from;
+}
+
+int solve(struct search *search, struct board *board, struct snake snake,
+          bb_t walls, bb_t food, uint64_t seed, int cap, int *budget) {
+  // number of moves, up to `cap`, that `snake` can make without dying when it's
+  // alone behind `walls`, with its tail already moved for the current turn.
+  // that's a longest path problem, so there's nothing for it but exhaustive
+  // search. results are memoized by body and food, and `seed` should identify
+  // `walls`. returns -1 once `*budget` nodes have been searched
+  if (cap == 0)
+    return 0;
+  uint64_t key = bb_hash(snake.head, seed ^ snake.health << 8 ^ snake.taillag);
+  key = bb_hash(snake.body, key), key = bb_hash(food, key);
+  key = bb_hash(snake.axis & snake.body, key);
+  key = bb_hash(snake.sign & snake.body, key);
+  struct solved *solved = search->solved + key % SOLVE_SIZE;
+  if (solved->key == key && (solved->exact || solved->turns >= cap))
+    return solved->turns < cap ? solved->turns : cap;
+  if (--*budget < 0)
+    return -1;
+
+  // same moves as in `step_kernel()` and `turn()`, on a copy of the snake
+  int best = 0, rules = board->rules;
+  for (int m = 0; m < 4 && best < cap; m++) {
+    bool axis = m >> 1, sign = m & 1;
+    if (outside(rules, bb_ctz(snake.head), m, board))
+      continue;
+
+    struct snake next = snake;
+    bb_t next_food = food;
+    axis ? (next.axis |= next.head) : (next.axis &= ~next.head);
+    sign ? (next.sign |= next.head) : (next.sign &= ~next.head);
+    next.head = shift(rules, next.head, m, board);
+    if (bb_any(next.head & (next.body | walls)))
+      continue;
+    next.health--;
+    next.body |= next.head;
+    next.taillag && next.taillag--;
+    if (bb_any(next.head & food)) {
+      next.length++, next.taillag++, next.health = 100;
+      next_food &= ~next.head;
+    }
+    if (!next.health)
+      continue;
+    if (!next.taillag) {
+      next.body &= ~next.tail;
+      next.tail = shift(rules, next.tail,
+                        bb_any(next.axis & next.tail) << 1 |
+                            bb_any(next.sign & next.tail),
+                        board);
+    }
+
+    int turns = solve(search, board, next, walls, next_food, seed, cap - 1,
+                      budget);
+    if (turns < 0)
+      return -1;
+    best = turns + 1 > best ? turns + 1 : best;
+  }
+
+  *solved = (struct solved){key, best, best < cap};
+  return best;
+}
+
+bool endgame(struct search *search, struct board *board, struct best *best) {
+  // once every snake is walled off in a region of its own, nobody can get in
+  // anybody else's way and the game comes down to who can keep on moving for
+  // longest, which `solve()` works out one snake at a time instead of
+  // branching over every combination of moves. call when we're about to move.
+  // returns whether the game could be settled, in which case `*best` is a win
+  // if every opponent runs out of room before we do and a loss otherwise
+  int cells = board->width * board->height;
+  bb_t bodies = board->bodies, heads = {0};
+  for (int s = 0; s < MAX_SNAKES; s++)
+    if (board->snakes[s].health)
+      heads |= board->snakes[s].head;
+
+  // quick check that no opponent is right next to where we can go. most of
+  // the time one is, and there's no point in going any further
+  bb_t ours = region(board, board->snakes->head, bodies & ~board->snakes->body);
+  if (bb_any(adj(ours, board) & heads & ~board->snakes->head))
+    return false;
+  STAT(search->n_regions++);
+
+  // iterative deepening keeps coming back to the same boards, so remember
+  // those that couldn't be settled alongside the results of `solve()`
+  uint64_t key = ~board->hash;
+  struct solved *failed = search->solved + key % SOLVE_SIZE;
+  if (failed->key == key && failed->turns < 0)
+    return false;
+
+  // the move from which every body cell is free, as tails move along, unless
+  // the snake eats or dies first. see `turn()` for the order things happen in
+  short open[CELLS];
+  for (int s = 0; s < MAX_SNAKES; s++) {
+    struct snake *snake = board->snakes + s;
+    bb_t cell = snake->tail;
+    for (int k = 0; snake->health && k < snake->length; k++) {
+      open[bb_ctz(cell)] = k + 1 + (snake->taillag > 1 ? snake->taillag : 1);
+      if (bb_any(cell & snake->head))
+        break;
+      cell = shift(board->rules, cell,
+                   bb_any(snake->axis & cell) << 1 |
+                       bb_any(snake->sign & cell),
+                   board);
+    }
+  }
+
+  // past the move at which a wall around us opens up, there's no telling what
+  // happens, so there's no point in finding out how long we could last
+  int cap = cells;
+  bb_t border = adj(ours, board) & bodies & ~board->snakes->body;
+  for (bb_t b = border; bb_any(b); b &= ~bb_bit(bb_ctz(b)))
+    cap = open[bb_ctz(b)] < cap ? open[bb_ctz(b)] : cap;
+
+  // how long everyone can last on their own, treating other snakes as walls.
+  // we only need to know whether opponents outlast us, and if not, exactly
+  // when they run out of room, in which case their bodies vanish. if we can
+  // last until `cap`, we can't lose this way but can still win
+  int turns[MAX_SNAKES] = {0}, budget = SOLVE_NODES, horizon = 0;
+  bool win = true;
+  for (int s = 0; s < MAX_SNAKES; s++) {
+    struct snake *snake = board->snakes + s;
+    if (!snake->health)
+      continue;
+    bb_t walls = bodies & ~snake->body;
+    if ((turns[s] = solve(search, board, *snake, walls, board->food,
+                          bb_hash(walls, s), s ? *turns + 1 : cap, &budget)) <
+        0)
+      goto fail;
+    if (s && turns[s] >= *turns && *turns == cap)
+      goto fail;
+    if (s && turns[s] >= *turns)
+      win = false;
+    else if (s)
+      for (bb_t b = snake->body; bb_any(b); b &= ~bb_bit(bb_ctz(b)))
+        open[bb_ctz(b)] = turns[s] + 1 < open[bb_ctz(b)]
+                              ? turns[s] + 1
+                              : open[bb_ctz(b)];
+    if (s && turns[s] + 1 > horizon)
+      horizon = turns[s] + 1;
+  }
+  horizon = win ? horizon : *turns + 1;
+
+  // now make sure that's how it'd actually play out: flood fill from every
+  // head over time, letting snakes through body cells as they free up. for
+  // the above to hold, nobody may get near anybody else or get through
+  // anybody else's body before the game is settled
+  bb_t reach[MAX_SNAKES];
+  for (int s = 0; s < MAX_SNAKES; s++)
+    reach[s] = board->snakes[s].head;
+  for (int t = 1; t <= horizon; t++) {
+    bb_t passable = board->board & ~bodies;
+    for (bb_t b = bodies; bb_any(b); b &= ~bb_bit(bb_ctz(b)))
+      if (open[bb_ctz(b)] <= t)
+        passable |= bb_bit(bb_ctz(b));
+    for (int s = 0; s < MAX_SNAKES; s++)
+      if (board->snakes[s].health && t <= turns[s] + 1)
+        reach[s] |= adj(reach[s], board) & passable;
+  }
+  for (int s = 0; s < MAX_SNAKES; s++) {
+    if (!board->snakes[s].health)
+      continue;
+    if (bb_any(reach[s] & bodies & ~board->snakes[s].body))
+      goto fail;
+    for (int r = s + 1; r < MAX_SNAKES; r++)
+      if (board->snakes[r].health &&
+          bb_any((reach[s] | adj(reach[s], board)) & reach[r]))
+        goto fail;
+  }
+
+  // a win is as good as it gets, the sooner the better. a loss is as bad as it
+  // gets, but as with the tie breakers in `step_kernel()`, the later the better
+  int opponents = 0;
+  for (int s = 1; s < MAX_SNAKES; s++)
+    opponents += !!board->snakes[s].health;
+  STAT(search->n_settled++);
+  *best = (struct best){win ? EVAL_MAX / 2 - (horizon - 1) * 2
+                            : EVAL_MIN + *turns * (2 + opponents * 4),
+                        4};
+  return true;
+
+fail:
+  *failed = (struct solved){key, -1};
+  return false;
+}
+
+bool near(struct board *board, int s, int distance) {
+  // whether the head of snake `s` is at most `distance` moves away from ours,
+  // going around the bodies in the way
+  bb_t reach = board->snakes->head;
+  for (int d = 1; d < distance; d++)
+    reach |= adj(reach, board) & ~board->bodies;
+  return bb_any(adj(reach, board) & board->snakes[s].head);
+}
+
+// the search comes in one variant per ruleset. `step_kernel()`,
+// `best_reply_kernel()` and `turn_kernel()` take the ruleset as a constant and
+// call one another through `VARIANT()`, which then folds into a direct call.
+// `turn()` picks a variant once per iteration, so standard rules pay nothing
+// for the others
+
+typedef struct best
+turn_fn(struct search *search,
+        struct board *board /* modified in-place then restored */,
+        short (*evals)[4] /* a cache for iterative deepening */, short alpha,
+        short beta, int depth);
+typedef struct best step_fn(int s, struct search *search, struct board *board,
+                            short (*evals)[4], short alpha, short beta,
+                            int depth);
+turn_fn turn, turn_standard, turn_wrapped, turn_royale, turn_constrictor;
+step_fn step_standard, step_wrapped, step_royale, step_constrictor;
+step_fn best_reply_standard, best_reply_wrapped, best_reply_royale,
+    best_reply_constrictor;
+typedef long long perft_fn(int s, struct board *board, int depth, bool check);
+perft_fn perft_standard, perft_wrapped, perft_royale, perft_constrictor;
+
+#define VARIANT(f, rules)                                                      \
+  ((rules) == RULES_WRAPPED       ? f##_wrapped                                \
+   : (rules) == RULES_ROYALE      ? f##_royale                                 \
+   : (rules) == RULES_CONSTRICTOR ? f##_constrictor                            \
+                                  : f##_standard)
+
+// making and unmaking moves, shared by the search and by `perft_kernel()`.
+// a move is made in two halves, because whether the head can go where it's
+// moving is only known once it's there
+
+KERNEL void move_head(int rules, struct snake *snake, int move,
+                      struct board *board) {
+  // record the path to the new head, then move the head. undone by shifting it
+  // back with `move ^ 1`. the path at the head itself is garbage, so it isn't
+  // restored
+  bool axis = move >> 1, sign = move & 1;
+  axis ? (snake->axis |= snake->head) : (snake->axis &= ~snake->head);
+  sign ? (snake->sign |= snake->head) : (snake->sign &= ~snake->head);
+  snake->head = shift(rules, snake->head, move, board);
+}
+
+KERNEL void move_body(int rules, int s, int cell, int move,
+                      struct board *board) {
+  // the rest of the move of snake `s` from `cell`: hash, health, body, food and
+  // growth. undone by `unmove_body()`, except for the hash
+  struct snake *snake = board->snakes + s;
+  bool axis = move >> 1, sign = move & 1;
+  int next = rules == RULES_WRAPPED
+                 ? bb_ctz(snake->head)
+                 : cell + (sign ? 1 : -1) * (axis ? board->width : 1);
+  board->hash ^= zobrist.head[s][cell] ^ zobrist.head[s][next] ^
+                 zobrist.body[s][next];
+
+  drain(rules, snake, board, board->food);
+  snake->body |= snake->head;
+  board->bodies |= snake->head;
+  snake->taillag && snake->taillag--;
+  if (bb_any(snake->head & board->food)) {
+    snake->length++, snake->taillag++, snake->health = 100;
+    board->food &= ~snake->head;
+    board->hash ^= zobrist.food[next];
+  }
+  if (rules == RULES_CONSTRICTOR)
+    snake->length++, snake->taillag++, snake->health = 100;
+  // a snake that starved is no longer in anybody's way
+  if (!snake->health)
+    board->bodies &= ~snake->body;
+}
+
+KERNEL void unmove_body(int rules, struct snake *snake, struct board *board,
+                        unsigned char length, unsigned char health,
+                        unsigned char taillag) {
+  // under constrictor rules, snakes grow by one whether they eat or not
+  if (snake->length > length + (rules == RULES_CONSTRICTOR))
+    board->food |= snake->head;
+  if (!snake->health)
+    board->bodies |= snake->body;
+  board->bodies &= ~snake->head;
+  snake->body &= ~snake->head;
+  snake->length = length, snake->health = health;
+  snake->taillag = taillag;
+}
+
+KERNEL int move_tail(int rules, int s, struct board *board) {
+  // move the tail of snake `s` toward the head according to `snake.axis` and
+  // `snake.sign`. returns the move the tail made, for `unmove_tail()`
+  struct snake *snake = board->snakes + s;
+  snake->body &= ~snake->tail;
+  board->bodies &= ~snake->tail;
+  board->hash ^= zobrist.body[s][bb_ctz(snake->tail)];
+  int move = bb_any(snake->axis & snake->tail) << 1 |
+             bb_any(snake->sign & snake->tail);
+  snake->tail = shift(rules, snake->tail, move, board);
+  return move;
+}
+
+KERNEL void unmove_tail(int rules, struct snake *snake, int move,
+                        struct board *board) {
+  // move the tail back where it was, and restore `snake.axis` and
+  // `snake.sign`, since they may have been overwritten during the turn
+  snake->tail = shift(rules, snake->tail, move ^ 1, board);
+  move >> 1 ? (snake->axis |= snake->tail) : (snake->axis &= ~snake->tail);
+  move & 1 ? (snake->sign |= snake->tail) : (snake->sign &= ~snake->tail);
+  snake->body |= snake->tail;
+  board->bodies |= snake->tail;
+}
+
+KERNEL struct best step_kernel(int rules, int s, struct search *search,
+                               struct board *board, short (*evals)[4],
+                               short alpha, short beta, int depth) {
   // perform one minimax step. in one "step", only one snake moves
 
   if (!board->snakes->health)
@@ -190,38 +1202,151 @@ struct best step(int s, clock_t cutoff, jmp_buf abort, struct board *board,
 
   if (depth == 0)
     // `* 2` because the least significant bit of evals is used as a mark
-    return (struct best){eval(board) * 2};
-
-  if (depth >= CHECK_DEPTH && clock() > cutoff)
-    longjmp(abort, 1);
+    return count(&search->n_evals), (struct best){eval(rules, board) * 2};
 
-  // skip over dead snakes and find the next live snake. if we iterate past the
-  // last snake, then all live snakes have moved this turn, so call `turn()` to
-  // begin the next turn
+  // skip over dead and frozen snakes and find the next live snake. if we
+  // iterate past the last snake, then all live snakes have moved this turn, so
+  // call `turn()` to begin the next turn
   do
     if (++s == MAX_SNAKES)
-      return turn(cutoff, abort, board, evals, alpha, beta, depth);
-  while (!board->snakes[s].health);
+      return VARIANT(turn, rules)(search, board, evals, alpha, beta, depth);
+  while (!board->snakes[s].health || board->snakes[s].frozen);
+
+  // Best-Reply Search: once we've moved, `best_reply_kernel()` picks which
+  // opponent branches this turn
+  if (s && search->replier < 0)
+    return VARIANT(best_reply, rules)(s - 1, search, board, evals, alpha, beta,
+                                      depth);
+
+  // abort when out of time or when another thread has already completed the
+  // current iteration, in which case there's no point in finishing it. polling
+  // by node count rather than by depth keeps the time between two checks
+  // about the same no matter how the tree is shaped
+  count(&search->n_nodes);
+  if (atomic_load_explicit(&search->n_nodes, memory_order_relaxed) %
+              CHECK_NODES ==
+          0 &&
+      (wall_clock() > search->cutoff ||
+       atomic_load_explicit(&search->shared->depth, memory_order_relaxed) >=
+           search->depth ||
+       atomic_load_explicit(&search->shared->stop, memory_order_relaxed)))
+    longjmp(search->abort, 1);
 
   struct snake *snake = board->snakes + s;
 
+  // transposition table: reuse the result of an earlier search of this same
+  // board if it was at least as deep, and otherwise at least explore its best
+  // move first. the root is never cut off because its evals are needed
+  int ply = evals - search->evals;
+  uint64_t hash = board->hash, key = hash ^ zobrist.mover[s];
+  unsigned char tt_move = 4; // 4 is an invalid move
+  if (depth >= TT_DEPTH) {
+    STAT(search->n_probes++);
+    uint64_t data = tt_probe(key);
+    short tt_eval = (short)(uint16_t)data;
+    int tt_depth = data >> 16 & 0xff, tt_bound = data >> 24 & 0xff;
+    if (data) {
+      STAT(search->n_hits++), tt_move = data >> 32 & 0xff;
+      if (tt_depth >= depth && evals != search->evals &&
+          (tt_bound == TT_EXACT || tt_bound == TT_LOWER && tt_eval >= beta ||
+           tt_bound == TT_UPPER && tt_eval <= alpha)) {
+        search->pv[ply][ply] = tt_move, search->pv_len[ply] = ply + 1;
+        return STAT(search->n_cutoffs++), (struct best){tt_eval, tt_move};
+      }
+    }
+  }
+
+  // separated regions: if nobody can interfere with anybody else anymore, the
+  // outcome is known without searching any further. the root is never settled
+  // this way because its evals are needed. under royale and constrictor rules,
+  // hazards cut paths short and walls never open, so `solve()` comes down to
+  // exhaustive search so often that it costs more depth than it saves
+  struct best settled;
+  if (s == 0 && evals != search->evals && depth >= SOLVE_DEPTH &&
+      (rules == RULES_STANDARD || rules == RULES_WRAPPED) &&
+      endgame(search, board, &settled)) {
+    search->pv[ply][ply] = settled.move, search->pv_len[ply] = ply + 1;
+    return settled;
+  }
+
   struct best best = {s ? EVAL_MAX : EVAL_MIN};
+  short alpha_orig = alpha, beta_orig = beta;
   unsigned char length = snake->length, health = snake->health;
   unsigned char taillag = snake->taillag;
+  int cell = bb_ctz(snake->head);
   bool did_recurse = false;
+  int n_children = 0;
 
   // about to move, so remove our head from the bitboard containing the heads of
-  // snakes that haven't yet moved this turn
+  // snakes that haven't yet moved this turn. the cells next to theirs are
+  // found once here rather than once per move
   board->heads &= ~snake->head;
+  bb_t threats = adj_kernel(rules, board->heads, board);
+
+  // batched leaf evaluation: at depth 1, every child is a leaf and the children
+  // differ from one another by a single head. so seed the Voronoi heuristic of
+  // every child up front, making and unmaking moves the same way the loop
+  // below does, and flood fill all of them at once. moves that turn out to be
+  // illegal or pruned just waste a lane
+  bb_t bodies4[4] = {0}, owned4[4] = {0}, lost4[4] = {0};
+  if (depth == 1) {
+    // the seeds aren't incremental: the fill that follows is bit-parallel over
+    // the whole board, so it can't be narrowed down to the cells around the
+    // moved head, and reusing the parent's frontiers only saved a few shifts
+    bb_t others = board->bodies & ~snake->body, bodies = board->bodies;
+    for (int m = 0; m < 4; m++) {
+      if (outside(rules, cell, m, board))
+        continue;
+
+      bb_t head = snake->head, body = snake->body, food = board->food;
+      snake->head = shift(rules, snake->head, m, board);
+      drain(rules, snake, board, board->food);
+      snake->body |= snake->head;
+      snake->taillag && snake->taillag--;
+      if (bb_any(snake->head & board->food)) {
+        snake->length++, snake->taillag++, snake->health = 100;
+        board->food &= ~snake->head;
+      }
+      if (rules == RULES_CONSTRICTOR)
+        snake->length++, snake->taillag++, snake->health = 100;
+
+      board->bodies = others | (snake->health ? snake->body : (bb_t){0});
+
+      eval_seed(rules, board, bodies4 + m, owned4 + m, lost4 + m);
+
+      board->bodies = bodies;
+      snake->head = head, snake->body = body, board->food = food;
+      snake->length = length, snake->health = health;
+      snake->taillag = taillag;
+    }
+
+    board->kernel->fill4(board, bodies4, owned4, lost4);
+  }
 
-  for (int i = 0; i < 4; i++) {
-    // iterative deepening: explore more promising moves first (as given
-    // by cached evals in `evals`) to maximize the number of pruned
-    // branches. cached evals are marked as "explored" by setting their
-    // least significant bit
+  // in Best-Reply Search, opponents other than the one replying play whichever
+  // move ordering puts first, or die if they have none
+  bool follows = s && search->replier > 0 && s != search->replier;
+  for (int i = 0; i < 4 && !(follows && did_recurse); i++) {
+    // move ordering: explore more promising moves first to maximize the
+    // number of pruned branches. that's the transposition table's move, then
+    // the killer move, then whichever move has the most history and finally,
+    // for iterative deepening, the one with the best cached eval in `evals`.
+    // cached evals are marked as "explored" by setting their least significant
+    // bit. history and killers are per thread, so they're free of contention
     short *evalp = *evals;
+    int *history = search->history[s][cell];
     for (short *e = *evals; e < *evals + 4; e++)
-      evalp = (*evalp & 1) || !(*e & 1) && *e > *evalp == !s ? e : evalp;
+      evalp = (*evalp & 1) ||
+                      !(*e & 1) &&
+                          (history[e - *evals] != history[evalp - *evals]
+                               ? history[e - *evals] > history[evalp - *evals]
+                               : *e > *evalp == !s)
+                  ? e
+                  : evalp;
+    if (i == 0 && tt_move < 4)
+      evalp = *evals + tt_move;
+    else if (search->killers[ply] < 4 && !((*evals)[search->killers[ply]] & 1))
+      evalp = *evals + search->killers[ply];
 
     // invariant: uncommenting either of these may slow down search and give
     // different evals but should never change what the final best `move` is
@@ -235,106 +1360,192 @@ struct best step(int s, clock_t cutoff, jmp_buf abort, struct board *board,
 
     // default to the worst possible eval, for `continue`s and `goto`s
     *evalp = (s ? EVAL_MAX : EVAL_MIN) | 1;
+    search->pv_len[ply + 1] = ply + 1;
     int tiebreak = 0;
 
+    // when pondering, our move at the root has already been played
+    if (evals == search->evals && search->shared->only < 4 &&
+        evalp - *evals != search->shared->only)
+      continue;
+
     // when minimax is hopelessly broken and commenting out these two lines
     // fixes it, it's likely there's an eval overflowing somewhere
     if (alpha >= beta)
       continue;
 
-    bool axis = (evalp - *evals) >> 1, sign = (evalp - *evals) & 1;
+    int move = evalp - *evals;
 
-    if (!axis && !sign && !(snake->head & board->xmask) ||
-        !axis && sign && !(snake->head << 1 & board->xmask) ||
-        axis && !sign && !(snake->head >> board->width) ||
-        axis && sign && !(snake->head << board->width & board->board))
+    if (outside(rules, cell, move, board))
       continue; // would move out of bounds
 
-    axis ? (snake->axis |= snake->head) : (snake->axis &= ~snake->head);
-    sign ? (snake->sign |= snake->head) : (snake->sign &= ~snake->head);
-    sign ? (snake->head <<= axis ? board->width : 1)
-         : (snake->head >>= axis ? board->width : 1);
+    move_head(rules, snake, move, board);
 
-    for (int r = 0; r < MAX_SNAKES; r++)
-      if (board->snakes[r].health && (snake->head & board->snakes[r].body))
-        goto contin; // would collide with another snake
+    if (bb_any(snake->head & board->bodies))
+      goto contin; // would collide with a snake
 
     // can't move adjacent to the head of a longer snake that hasn't yet moved
     // this turn because they could kill us by moving onto our head
-    bb_t head_adj = adj(snake->head, board);
-    if (head_adj & board->heads)
+    if (bb_any(snake->head & threats)) {
+      bb_t head_adj = adj_kernel(rules, snake->head, board);
       for (int r = s + 1; r < MAX_SNAKES; r++)
         if (board->snakes[r].length >= snake->length &&
-            board->snakes[r].health && (head_adj & board->snakes[r].head)) {
+            board->snakes[r].health &&
+            bb_any(head_adj & board->snakes[r].head)) {
           // tie breaker: prefer a probable head-to-head death to certain death
           tiebreak += +16;
           goto update;
         }
-
-    snake->health--;
-    snake->body |= snake->head;
-    snake->taillag && snake->taillag--;
-    if (snake->head & board->food) {
-      snake->length++, snake->taillag++, snake->health = 100;
-      board->food &= ~snake->head;
     }
 
+    move_body(rules, s, cell, move, board);
+
     // `+2` because the least significant bit of evals is used as a mark.
     // tie breaker: even when certain death is coming, survive as long as we can
     tiebreak += +2;
     // tie breaker: certain death is better if it's contingent on an opponent
     tiebreak += s ? +2 : 0;
 
+    // principal variation search: the first move searched is likely the best
+    // one, so for the others, only prove they're worse with a null window
+    // around `alpha` if we're moving or around `beta` if an opponent is. if
+    // that fails, search again with the full window to get their actual eval.
+    // invariant: replacing `pvs` with `false` may slow down search and give
+    // different evals but should never change what the final best `move` is
+    bool pvs = did_recurse && beta - alpha > 1;
     did_recurse = true;
-    *evalp = step(s, cutoff, abort, board, evals + 1, alpha - tiebreak,
-                  beta - tiebreak, depth - 1)
-                 .eval;
+    // invariant: the batched branch should always give the same evals as the
+    // `step_kernel()` branch does
+    if (depth == 1)
+      *evalp = !board->snakes->health
+                   ? EVAL_MIN
+                   : (count(&search->n_evals),
+                      eval_score(rules, board, owned4[move], lost4[move]) * 2);
+    else {
+      if (pvs)
+        *evalp = VARIANT(step, rules)(s, search, board, evals + 1,
+                                      (s ? beta - 1 : alpha) - tiebreak,
+                                      (s ? beta : alpha + 1) - tiebreak,
+                                      depth - 1)
+                     .eval;
+      if (pvs && *evalp > alpha - tiebreak && *evalp < beta - tiebreak)
+        STAT(count(&search->n_researches)), pvs = false;
+      if (!pvs)
+        *evalp = VARIANT(step, rules)(s, search, board, evals + 1,
+                                      alpha - tiebreak, beta - tiebreak,
+                                      depth - 1)
+                     .eval;
+    }
+    board->hash = hash;
 
   update:
     *evalp += tiebreak;
-    if (s && *evalp < best.eval) {
-      best.eval = *evalp, best.move = evalp - *evals;
-      beta = best.eval < beta ? best.eval : beta;
-    }
-    if (!s && *evalp > best.eval) {
+    n_children++;
+    if (s ? *evalp < best.eval : *evalp > best.eval) {
       best.eval = *evalp, best.move = evalp - *evals;
-      alpha = best.eval > alpha ? best.eval : alpha;
+      s ? (beta = best.eval < beta ? best.eval : beta)
+        : (alpha = best.eval > alpha ? best.eval : alpha);
+
+      // beta cutoff: no need to search the remaining moves. remember what
+      // caused it so it gets searched first next time around
+      if (alpha >= beta) {
+        STAT(search->n_betas++, search->n_firsts += n_children == 1);
+        search->killers[ply] = best.move;
+        search->history[s][cell][best.move] += depth * depth;
+      }
+
+      // the principal variation is the best move followed by the principal
+      // variation of the subtree it leads to
+      search->pv[ply][ply] = best.move;
+      memcpy(search->pv[ply] + ply + 1, search->pv[ply + 1] + ply + 1,
+             search->pv_len[ply + 1] - ply - 1);
+      search->pv_len[ply] = search->pv_len[ply + 1];
+      // a root move that fails low on an aspiration window may not be better
+      // than any other, so it isn't worth falling back to
+      if (ply == 0 && best.eval > alpha_orig)
+        search->partial = best.move;
     }
 
     // mark the cached eval as explored
     *evalp |= 1;
 
-    if (snake->length > length)
-      board->food |= snake->head;
-    snake->body &= ~snake->head;
-    snake->length = length, snake->health = health;
-    snake->taillag = taillag;
+    unmove_body(rules, snake, board, length, health, taillag);
 
   contin:
-    sign ? (snake->head >>= axis ? board->width : 1)
-         : (snake->head <<= axis ? board->width : 1);
+    snake->head = shift(rules, snake->head, move ^ 1, board);
   }
 
   // unmark the evals we've just cached, to prepare for subsequent deepenings
   for (short *e = *evals; e < *evals + 4; e++)
     *e &= ~1;
+  STAT(search->n_children += n_children);
 
   // if an opponent has no available moves, mark them as dead and keep on
   // searching deeper. doing this manually is only necessary because we prune
   // branches that lead to immediate death
   if (s && !did_recurse) {
     snake->health = 0;
-    best = step(s, cutoff, abort, board, evals + 1, alpha, beta, depth - 1);
+    board->bodies &= ~snake->body;
+    board->hash ^= zobrist.dead[s];
+    search->pv_len[ply + 1] = ply + 1;
+    best = VARIANT(step, rules)(s, search, board, evals + 1, alpha, beta,
+                                depth - 1);
     snake->health = health;
+    board->bodies |= snake->body;
+    board->hash = hash;
+
+    search->pv[ply][ply] = 4; // 4 is an invalid move
+    memcpy(search->pv[ply] + ply + 1, search->pv[ply + 1] + ply + 1,
+           search->pv_len[ply + 1] - ply - 1);
+    search->pv_len[ply] = search->pv_len[ply + 1];
   }
 
   board->heads |= snake->head;
 
+  if (depth >= TT_DEPTH)
+    tt_store(key, best.eval, depth,
+             best.eval <= alpha_orig  ? TT_UPPER
+             : best.eval >= beta_orig ? TT_LOWER
+                                      : TT_EXACT,
+             best.move);
+
   return best;
 }
 
-struct best turn(clock_t cutoff, jmp_buf abort, struct board *board,
-                 short (*evals)[4], short alpha, short beta, int depth) {
+KERNEL struct best best_reply_kernel(int rules, int s, struct search *search,
+                                     struct board *board, short (*evals)[4],
+                                     short alpha, short beta, int depth) {
+  // Best-Reply Search: rather than every opponent branching in turn against us,
+  // which multiplies the size of the tree by 4 for every one of them, only one
+  // of them does, picked by the opponents as a whole, and the others play
+  // along. same calling convention as `step_kernel()`, with `s` the last snake
+  // to have moved. takes up no ply of its own
+  int ply = evals - search->evals;
+  struct best best = {EVAL_MAX, 4};
+  unsigned char pv[MAX_DEPTH];
+  int pv_len = ply;
+  for (int r = s + 1; r < MAX_SNAKES && alpha < beta; r++) {
+    if (!board->snakes[r].health || board->snakes[r].frozen)
+      continue;
+    search->replier = r;
+    board->hash ^= zobrist.replier[r];
+    struct best b =
+        VARIANT(step, rules)(s, search, board, evals, alpha, beta, depth);
+    board->hash ^= zobrist.replier[r];
+    if (b.eval < best.eval) {
+      best = b, beta = b.eval < beta ? b.eval : beta;
+      memcpy(pv + ply, search->pv[ply] + ply, search->pv_len[ply] - ply);
+      pv_len = search->pv_len[ply];
+    }
+  }
+  search->replier = -1;
+  memcpy(search->pv[ply] + ply, pv + ply, pv_len - ply);
+  search->pv_len[ply] = pv_len;
+  return best;
+}
+
+KERNEL struct best turn_kernel(int rules, struct search *search,
+                               struct board *board, short (*evals)[4],
+                               short alpha, short beta, int depth) {
   // perform one minimax turn. in one "turn", each snake moves once
 
 #if MAX_SNAKES <= 8
@@ -347,7 +1558,31 @@ struct best turn(clock_t cutoff, jmp_buf abort, struct board *board,
   uint_fast64_t
 #endif
       axes = 0,
-      sgns = 0;
+      sgns = 0, frozen = 0;
+  uint64_t hash = board->hash;
+
+  // opponent reduction: with two opponents or more, one that's too far from us
+  // to reach us before the search is over can't get in our way, so rather than
+  // branching over its moves, it sits out the turn, head and tail in place,
+  // and it moves again as soon as it comes within range. paranoid minimax
+  // makes this a big deal, since every opponent otherwise multiplies the size
+  // of the tree. sitting still rather than playing some fixed move keeps it
+  // from walking into dead ends no one searched, whose deaths would make the
+  // position look better than it is. every snake moves on the first turn,
+  // whose moves are the ones actually played
+  int opponents = 0, reduce = search->shared->limits.reduce;
+  for (int s = 1; s < MAX_SNAKES; s++)
+    opponents += !!board->snakes[s].health;
+  int range = 2 * (depth / (opponents + 1)) + 1;
+  range = range > reduce ? range : reduce;
+  reduce = reduce && opponents > 1 && evals != search->evals ? range : 0;
+
+  // Best-Reply Search, see `best_reply_kernel()`. the opponent that replied
+  // last turn doesn't matter anymore, so drop it from the hash
+  int replier = search->replier, brs = search->shared->limits.brs;
+  if (replier > 0)
+    board->hash ^= zobrist.replier[replier];
+  search->replier = brs && opponents > 1 && opponents + 1 >= brs ? -1 : 0;
 
   for (int s = 0; s < MAX_SNAKES; s++) {
     struct snake *snake = board->snakes + s;
@@ -355,172 +1590,1670 @@ struct best turn(clock_t cutoff, jmp_buf abort, struct board *board,
     if (!snake->health)
       continue;
 
+    frozen = frozen << 1 | snake->frozen;
+    snake->frozen = s && reduce && !near(board, s, reduce);
+    if (snake->frozen) {
+      STAT(search->n_reduced++);
+      board->hash ^= zobrist.frozen[s];
+      continue;
+    }
+
     board->heads |= snake->head;
 
     if (snake->taillag)
       continue;
 
-    // move the tail toward the head according to `snake.axis` and `snake.sign`
-    snake->body &= ~snake->tail;
-    axes <<= 1, sgns <<= 1;
-    axes |= !!(snake->axis & snake->tail);
-    sgns |= !!(snake->sign & snake->tail);
-    sgns & 1 ? (snake->tail <<= axes & 1 ? board->width : 1)
-             : (snake->tail >>= axes & 1 ? board->width : 1);
+    int move = move_tail(rules, s, board);
+    axes = axes << 1 | move >> 1, sgns = sgns << 1 | move & 1;
   }
 
-  struct best best = step(-1, cutoff, abort, board, evals, alpha, beta, depth);
+  struct best best =
+      VARIANT(step, rules)(-1, search, board, evals, alpha, beta, depth);
 
   for (int s = MAX_SNAKES; s--;) {
     struct snake *snake = board->snakes + s;
 
-    if (!snake->health || snake->taillag)
+    if (!snake->health)
+      continue;
+
+    bool was_frozen = snake->frozen;
+    snake->frozen = frozen & 1, frozen >>= 1;
+    if (was_frozen || snake->taillag)
       continue;
 
-    // move the tail back where it was, and restore `snake.axis` and
-    // `snake.sign`, since we may have overwritten it during the turn
-    sgns & 1 ? (snake->tail >>= axes & 1 ? board->width : 1)
-             : (snake->tail <<= axes & 1 ? board->width : 1);
-    axes & 1 ? (snake->axis |= snake->tail) : (snake->axis &= ~snake->tail);
-    sgns & 1 ? (snake->sign |= snake->tail) : (snake->sign &= ~snake->tail);
+    unmove_tail(rules, snake, (axes & 1) << 1 | sgns & 1, board);
     axes >>= 1, sgns >>= 1;
-    snake->body |= snake->tail;
   }
 
-  board->heads = 0;
+  board->heads = (bb_t){0};
+  board->hash = hash;
+  search->replier = replier;
 
   return best;
 }
 
-int main(void) {
-  static char req[1 << 16];
-  size_t size = fread(req, 1, sizeof req - 1, stdin);
-  if (ferror(stdin))
-    perror("fread"), exit(EXIT_FAILURE);
-  if (!feof(stdin))
-    fputs("request buffer exhausted\n", stderr), exit(EXIT_FAILURE);
-  req[size] = '\0';
+bool identical(struct board *a, struct board *b) {
+  // whether unmaking moves put the board back exactly the way it was. paths are
+  // only ever read along bodies, and the path at the head is garbage, see
+  // `move_head()`
+  if (bb_any(a->food ^ b->food | a->heads ^ b->heads | a->bodies ^ b->bodies |
+             a->board ^ b->board | a->xmask ^ b->xmask |
+             a->hazards ^ b->hazards) ||
+      a->width != b->width || a->height != b->height || a->rules != b->rules ||
+      a->hazard_damage != b->hazard_damage || a->hash != b->hash ||
+      a->kernel != b->kernel)
+    return false;
+  for (struct snake *p = a->snakes, *q = b->snakes; p < a->snakes + MAX_SNAKES;
+       p++, q++)
+    if (bb_any(p->head ^ q->head | p->tail ^ q->tail | p->body ^ q->body |
+               (p->axis ^ q->axis | p->sign ^ q->sign) & p->body &
+                   ~p->head) ||
+        p->length != q->length || p->health != q->health ||
+        p->taillag != q->taillag || p->frozen != q->frozen)
+      return false;
+  return true;
+}
 
-  // see example-move.json
+KERNEL long long perft_kernel(int rules, int s, struct board *board, int depth,
+                              bool check) {
+  // count the positions `depth` plies away, making and unmaking moves the same
+  // way `step_kernel()` and `turn_kernel()` do, but without pruning, ordering
+  // or evaluating anything. moving next to a longer head is legal here, and
+  // games we've lost end early and count for nothing. with `check`, the board
+  // must be exactly the same after every unmake as it was before the make
 
-  char *j_yid = jsonw_lookup(
-      "id", jsonw_beginobj(jsonw_lookup("you", jsonw_beginobj(req))));
-  char *j_yid_end = jsonw_string(NULL, j_yid);
-  if (!j_yid_end)
-    fputs("bad you id\n", stderr), exit(EXIT_FAILURE);
-  ptrdiff_t j_yid_sz = j_yid_end - j_yid;
+  if (!board->snakes->health)
+    return 0;
 
-  struct board board = {0};
+  // the union of the bodies must be what it would be if built from scratch
+  if (check) {
+    bb_t bodies = {0};
+    for (int r = 0; r < MAX_SNAKES; r++)
+      if (board->snakes[r].health)
+        bodies |= board->snakes[r].body;
+    if (bb_any(bodies ^ board->bodies))
+      fputs("perft: union of bodies out of date\n", stderr),
+          exit(EXIT_FAILURE);
+  }
 
-  char *j_board = jsonw_lookup("board", jsonw_beginobj(req));
-  if (!jsonw_uchar(&board.width,
-                   jsonw_lookup("width", jsonw_beginobj(j_board))))
-    fputs("bad board width\n", stderr), exit(EXIT_FAILURE);
-  if (!jsonw_uchar(&board.height,
-                   jsonw_lookup("height", jsonw_beginobj(j_board))))
-    fputs("bad board height\n", stderr), exit(EXIT_FAILURE);
-  if (board.width * board.height > 128)
-    fputs("board too large\n", stderr), exit(EXIT_FAILURE);
+  if (depth == 0)
+    return 1;
 
-  board.board = ((bb_t)1 << board.width * board.height) - 1;
-  for (unsigned char y = 0; y < board.height; y++)
-    board.xmask <<= board.width, board.xmask |= 1;
-  board.xmask = board.board & ~board.xmask;
+  struct board before;
+  uint64_t hash = board->hash;
+  long long n = 0;
 
-  char *j_food = jsonw_lookup("food", jsonw_beginobj(j_board));
-  for (char *j_point = jsonw_beginarr(j_food); j_point;
-       j_point = jsonw_element(j_point)) {
-    unsigned char x, y;
-    if (!jsonw_uchar(&x, jsonw_lookup("x", jsonw_beginobj(j_point))))
-      fputs("bad food x\n", stderr), exit(EXIT_FAILURE);
-    if (!jsonw_uchar(&y, jsonw_lookup("y", jsonw_beginobj(j_point))))
-      fputs("bad food y\n", stderr), exit(EXIT_FAILURE);
-    if (x > board.width || y > board.height)
-      fputs("bad food point\n", stderr), exit(EXIT_FAILURE);
+  // once every live snake has moved, move the tails to begin the next turn
+  do
+    if (++s == MAX_SNAKES) {
+      int moves[MAX_SNAKES];
+      if (check)
+        before = *board;
+      for (int r = 0; r < MAX_SNAKES; r++)
+        if (board->snakes[r].health) {
+          board->heads |= board->snakes[r].head;
+          if (!board->snakes[r].taillag)
+            moves[r] = move_tail(rules, r, board);
+        }
 
-    board.food |= (bb_t)1 << x + y * board.width;
-  }
+      n = VARIANT(perft, rules)(-1, board, depth, check);
+
+      for (int r = MAX_SNAKES; r--;)
+        if (board->snakes[r].health && !board->snakes[r].taillag)
+          unmove_tail(rules, board->snakes + r, moves[r], board);
+      board->heads = (bb_t){0};
+      board->hash = hash;
+      if (check && !identical(&before, board))
+        fprintf(stderr, "perft: turn corrupts the board\n"),
+            exit(EXIT_FAILURE);
+      return n;
+    }
+  while (!board->snakes[s].health);
 
-  int s = 1;
-  unsigned int seed = 0;       // for srand()
-  unsigned char prev_move = 4; // 4 is an invalid move
-  char *j_snakes = jsonw_lookup("snakes", jsonw_beginobj(j_board));
-  for (char *j_snake = jsonw_beginarr(j_snakes); j_snake;
-       j_snake = jsonw_element(j_snake)) {
+  struct snake *snake = board->snakes + s;
+  unsigned char length = snake->length, health = snake->health;
+  unsigned char taillag = snake->taillag;
+  int cell = bb_ctz(snake->head);
+  bool moved = false;
+
+  board->heads &= ~snake->head;
+  if (check)
+    before = *board;
+
+  for (int move = 0; move < 4; move++) {
+    if (outside(rules, cell, move, board))
+      continue;
+
+    move_head(rules, snake, move, board);
+    if (!bb_any(snake->head & board->bodies)) {
+      moved = true;
+      move_body(rules, s, cell, move, board);
+      n += VARIANT(perft, rules)(s, board, depth - 1, check);
+      board->hash = hash;
+      unmove_body(rules, snake, board, length, health, taillag);
+    }
+    snake->head = shift(rules, snake->head, move ^ 1, board);
+
+    if (check && !identical(&before, board))
+      fprintf(stderr, "perft: move %d of snake %d corrupts the board\n", move,
+              s),
+          exit(EXIT_FAILURE);
+  }
+
+  // opponents with nowhere to go die, like in `step_kernel()`
+  if (s && !moved) {
+    snake->health = 0;
+    board->bodies &= ~snake->body;
+    board->hash ^= zobrist.dead[s];
+    n = VARIANT(perft, rules)(s, board, depth - 1, check);
+    snake->health = health;
+    board->bodies |= snake->body;
+    board->hash = hash;
+  }
+
+  board->heads |= snake->head;
+  return n;
+}
+
+long long perft(struct board *board, int depth, bool check) {
+  // perft from the beginning of a turn, like `turn()`
+  return VARIANT(perft, board->rules)(MAX_SNAKES - 1, board, depth, check);
+}
+
+#define RULESET(name, rules)                                                   \
+  struct best step_##name(int s, struct search *search, struct board *board,   \
+                          short (*evals)[4], short alpha, short beta,          \
+                          int depth) {                                         \
+    return step_kernel(rules, s, search, board, evals, alpha, beta, depth);    \
+  }                                                                            \
+  struct best best_reply_##name(int s, struct search *search,                  \
+                                struct board *board, short (*evals)[4],        \
+                                short alpha, short beta, int depth) {          \
+    return best_reply_kernel(rules, s, search, board, evals, alpha, beta,      \
+                             depth);                                           \
+  }                                                                            \
+  struct best turn_##name(struct search *search, struct board *board,          \
+                          short (*evals)[4], short alpha, short beta,          \
+                          int depth) {                                         \
+    return turn_kernel(rules, search, board, evals, alpha, beta, depth);       \
+  }                                                                            \
+  long long perft_##name(int s, struct board *board, int depth, bool check) {  \
+    return perft_kernel(rules, s, board, depth, check);                        \
+  }
+RULESET(standard, RULES_STANDARD)
+RULESET(wrapped, RULES_WRAPPED)
+RULESET(royale, RULES_ROYALE)
+RULESET(constrictor, RULES_CONSTRICTOR)
+
+struct best turn(struct search *search, struct board *board,
+                 short (*evals)[4], short alpha, short beta, int depth) {
+  return VARIANT(turn, board->rules)(search, board, evals, alpha, beta, depth);
+}
+
+clock_t predict(struct shared *shared, int depth) {
+  // predict the `wall_clock()` time at which an iteration to `depth` would
+  // complete, with `shared->mutex` held. the time to complete a depth grows
+  // geometrically, by the effective branching factor, so extrapolate from the
+  // last two depths completed. returns 0 if there isn't enough data yet
+  int d = shared->depth;
+  if (d < 1 || depth <= d || !shared->done[d] ||
+      shared->done[d - 1] <= shared->start)
+    return 0;
+  double elapsed = shared->done[d] - shared->start;
+  double ebf = elapsed / (shared->done[d - 1] - shared->start);
+  ebf = ebf < 1 ? 1 : ebf > 16 ? 16 : ebf; // timer noise at shallow depths
+  for (; d < depth; d++)
+    elapsed *= ebf;
+  return shared->start + (clock_t)elapsed;
+}
+
+void *deepen(void *arg) {
+  // run iterative deepening in one of the threads of a search
+  struct search *search = arg;
+  struct shared *shared = search->shared;
+
+  while (!atomic_load(&shared->stop)) {
+    pthread_mutex_lock(&shared->mutex);
+    int from = shared->depth > shared->warm ? shared->depth : shared->warm;
+    search->depth = from + 1 + ((search - shared->searches) & 1);
+    // if the game engine doesn't receive our move within `TOTAL_TIME`, we time
+    // out and the move we made on the previous turn is repeated. so when the
+    // current `best.move` happens to be the same as our previous move, timing
+    // out is okay and we can keep on searching past `SEARCH_TIME`. credit to
+    // John Scales for the idea
+    // when searches outnumber cores, some of them time-share, and their
+    // replies then take longer to get out once they're done. so give up SLACK
+    // per excess search, and take it back as they finish. deadlines count from
+    // the arrival of the request, so time spent waiting for us is accounted for
+    clock_t search_time = shared->limits.search_time;
+    int excess = atomic_load_explicit(&scheduler.searches,
+                                      memory_order_relaxed) -
+                 scheduler.cores;
+    if (shared->limits.schedule && excess > 0) {
+      clock_t slack = (clock_t)CLOCKS_PER_SEC * SLACK * excess / 1000;
+      search_time -= slack < search_time / 2 ? slack : search_time / 2;
+    }
+    search->cutoff = shared->move == shared->prev_move
+                         ? shared->start + shared->limits.total_time
+                         : shared->start + search_time;
+    clock_t finish = predict(shared, search->depth);
+    if (finish > search->cutoff)
+      shared->predicted = finish;
+    // aspiration window: the root eval is unlikely to change much from one
+    // iteration to the next, so search a narrow window around the last one
+    // first. no eval to go on when warm-starting, so use the full window
+    short alpha = EVAL_MIN, beta = EVAL_MAX;
+    if (shared->depth >= 0 && shared->done[shared->depth]) {
+      short eval = EVAL_MIN;
+      for (int m = 0; m < 4; m++)
+        eval = shared->root_evals[m] > eval ? shared->root_evals[m] : eval;
+      alpha = eval - ASPIRATION > EVAL_MIN ? eval - ASPIRATION : EVAL_MIN;
+      beta = eval + ASPIRATION < EVAL_MAX ? eval + ASPIRATION : EVAL_MAX;
+    }
+    pthread_mutex_unlock(&shared->mutex);
+
+    if (search->depth > shared->limits.depth)
+      break;
+    // don't bother starting an iteration that won't finish in time. the search
+    // as a whole is over as soon as the calling thread gives up, see `think()`
+    if (finish > search->cutoff)
+      break;
+
+    // an aborted iteration leaves the board half-modified and some cached evals
+    // marked as explored, so start every iteration from a clean slate
+    search->board = shared->board;
+    if (shared->limits.reduce) // any distance past the board freezes no one
+      search->board.hash ^=
+          zobrist.reduce[shared->limits.reduce < CELLS ? shared->limits.reduce
+                                                       : CELLS - 1];
+    search->pv_len[0] = 0;
+    search->partial = 4; // 4 is an invalid move
+    search->replier = 0;
+    for (int *h = **search->history;
+         h < **search->history + sizeof search->history / sizeof(int); h++)
+      *h >>= 1;
+    for (int d = 0; d < MAX_DEPTH; d++)
+      for (unsigned char m = 0; m < 4; m++)
+        search->evals[d][m] &= ~1;
+
+    if (setjmp(search->abort) != 0) {
+      if (wall_clock() <= search->cutoff)
+        continue; // another thread beat us to it, so go deeper
+
+      // out of time. the root moves searched to completion in this iteration
+      // are better informed than those of the previous iteration. the first
+      // root move searched is the previous iteration's best one, so if another
+      // one comes out ahead, it really is better
+      pthread_mutex_lock(&shared->mutex);
+      if (search->partial < 4 && search->depth > shared->depth &&
+          search->depth > shared->partial_depth)
+        shared->move = search->partial, shared->partial_depth = search->depth;
+      pthread_mutex_unlock(&shared->mutex);
+      break;
+    }
+
+    // if the root eval falls outside the window, it's only a bound, so widen
+    // the window on that side and search again. `search->board` and
+    // `search->evals` are left clean by a search that wasn't aborted
+    struct best best;
+    for (;;) {
+      best = turn(search, &search->board, search->evals, alpha, beta,
+                  search->depth);
+      if (best.eval <= alpha && alpha > EVAL_MIN)
+        count(&search->n_lows), alpha = EVAL_MIN;
+      else if (best.eval >= beta && beta < EVAL_MAX)
+        count(&search->n_highs), beta = EVAL_MAX;
+      else
+        break;
+    }
+
+    pthread_mutex_lock(&shared->mutex);
+    if (search->depth > shared->depth) {
+      atomic_store(&shared->depth, search->depth);
+      shared->move = best.move;
+      memcpy(shared->root_evals, search->evals, sizeof shared->root_evals);
+      memcpy(shared->pv, search->pv[0], shared->pv_len = search->pv_len[0]);
+
+      clock_t now = wall_clock();
+      int n_evals = 0, n_highs = 0, n_lows = 0, n_researches = 0;
+      long long n_nodes = 0;
+      for (struct search *t = shared->searches;
+           t < shared->searches + shared->threads; t++)
+        n_nodes += atomic_load_explicit(&t->n_nodes, memory_order_relaxed),
+            n_evals += atomic_load_explicit(&t->n_evals, memory_order_relaxed),
+            n_highs += atomic_load_explicit(&t->n_highs, memory_order_relaxed),
+            n_lows += atomic_load_explicit(&t->n_lows, memory_order_relaxed),
+            n_researches +=
+            atomic_load_explicit(&t->n_researches, memory_order_relaxed);
+      fprintf(shared->log, "%d\t%06lld\t%06lld\t%7d\t%7lld\t%d\t%d\t%d\n",
+              search->depth,
+              (long long)(now - shared->prev) * 1000000 / CLOCKS_PER_SEC,
+              (long long)(now - shared->start) * 1000000 / CLOCKS_PER_SEC,
+              n_evals,
+              (long long)n_evals * CLOCKS_PER_SEC / (now - shared->start),
+              n_highs, n_lows, n_researches);
+      shared->prev = now;
+      shared->done[search->depth] = now;
+      shared->nodes[search->depth] = n_nodes;
+    }
+    pthread_mutex_unlock(&shared->mutex);
+  }
+
+  return NULL;
+}
+
+void pin(pthread_t thread, uint64_t cores) {
+  // restrict a thread to `cores`, one bit per core of `scheduler`, or let it
+  // run on any of them if 0. pinning is only a hint, so failing is okay
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int c = 0; c < scheduler.cores; c++)
+    if (!cores || cores >> c & 1)
+      CPU_SET(scheduler.cpus[c], &set);
+  pthread_setaffinity_np(thread, sizeof set, &set);
+#else
+  (void)thread, (void)cores;
+#endif
+}
+
+int run(struct search *searches, int threads) {
+  // run a search on `threads` threads and return how many actually ran. the
+  // calling thread doubles as the first search thread. if a helper can't be
+  // spawned, the search just runs with fewer threads. with `limits.cores`, the
+  // threads only run on those cores until the search is over
+  uint64_t cores = searches->shared->limits.cores;
+  if (cores)
+    pin(pthread_self(), cores);
+  int t = 1;
+  for (; t < threads; t++)
+    if (pthread_create(&searches[t].thread, NULL, deepen, searches + t) != 0)
+      break;
+    else if (cores)
+      pin(searches[t].thread, cores);
+  deepen(searches);
+  atomic_store(&searches->shared->stop, true);
+  for (int u = 1; u < t; u++)
+    pthread_join(searches[u].thread, NULL);
+  if (cores)
+    pin(pthread_self(), 0);
+  return t;
+}
+
+bool legal(struct board *board, unsigned char move) {
+  // whether we can make `move` at the root without dying on the spot. mirrors
+  // the out-of-bounds and collision checks in `step_kernel()`, except that
+  // tails haven't been moved by `turn()` yet
+  bb_t head = board->snakes->head;
+  if (outside(board->rules, bb_ctz(head), move, board))
+    return false;
+  head = shift(board->rules, head, move, board);
+
+  for (int r = 0; r < MAX_SNAKES; r++)
+    if (board->snakes[r].health &&
+        bb_any(head & board->snakes[r].body &
+               ~(board->snakes[r].taillag ? (bb_t){0} : board->snakes[r].tail)))
+      return false;
+  return true;
+}
+
+// pondering: between our reply and the next request of the game, the server
+// sits idle while every other snake makes up its mind. so once we've replied,
+// keep searching the same position, our move in it settled, as if the search
+// had never been cut off. the transposition table fills up with the positions
+// the next request is likely to be about, and when it does turn out to be the
+// one the principal variation expected, the next search picks up from the
+// pondered depth rather than from the depth of the reply
+
+// whether `move()` ponders. bin/server turns it on, since a CGI process exits
+// right after replying
+bool pondering;
+
+struct ponder {
+  pthread_t thread;
+  struct shared shared; // its `depth` only counts depths pondered to completion
+  struct search searches[THREADS];
+  char *log_buf; // pondered depths are logged, but nobody reads them
+  size_t log_size;
+};
+
+void *ponder_search(void *arg) {
+  // keep searching until `ponder_stop()` or for a turn's worth of time
+  struct ponder *ponder = arg;
+  run(ponder->searches, ponder->shared.threads);
+  atomic_fetch_sub(&scheduler.pondering, ponder->shared.threads);
+  return NULL;
+}
+
+struct ponder *ponder_start(struct shared *shared, struct search *searches) {
+  // ponder the position of a search that just completed, with our reply to it.
+  // returns NULL if there are no resources to spare
+  struct ponder *ponder = malloc(sizeof *ponder);
+  if (ponder == NULL)
+    return NULL;
+  ponder->shared = *shared;
+  struct shared *p = &ponder->shared;
+  p->stop = false, p->only = shared->move, p->prev_move = 4;
+  // carry on from where the search left off, but only count depths pondered
+  // to completion, so that a hit that ponders none keeps the depth and
+  // principal variation of the search we replied with
+  p->warm = shared->depth > shared->warm ? shared->depth : shared->warm;
+  p->depth = -1;
+  p->partial_depth = 0, p->predicted = 0;
+  memset(p->done, 0, sizeof p->done);
+  memset(p->nodes, 0, sizeof p->nodes);
+  p->start = p->prev = wall_clock();
+  p->limits.search_time = p->limits.total_time;
+  // the search's cores go back to the scheduler as soon as it replies, so
+  // ponder on whatever cores are free instead
+  p->limits.schedule = false, p->limits.cores = 0;
+  p->searches = ponder->searches;
+  for (int t = 0; t < THREADS; t++)
+    ponder->searches[t] = searches[t], ponder->searches[t].shared = p;
+  if ((p->log = open_memstream(&ponder->log_buf, &ponder->log_size)) == NULL)
+    return free(ponder), NULL;
+  if (pthread_mutex_init(&p->mutex, NULL) != 0)
+    return fclose(p->log), free(ponder->log_buf), free(ponder), NULL;
+  atomic_fetch_add(&scheduler.pondering, p->threads);
+  if (pthread_create(&ponder->thread, NULL, ponder_search, ponder) != 0)
+    return atomic_fetch_sub(&scheduler.pondering, p->threads),
+           pthread_mutex_destroy(&p->mutex), fclose(p->log),
+           free(ponder->log_buf), free(ponder), NULL;
+  return ponder;
+}
+
+void ponder_stop(struct ponder *ponder) {
+  // stop pondering and wait for it. the results stay in `ponder->shared` and
+  // `ponder->searches` until it's freed
+  atomic_store(&ponder->shared.stop, true);
+  pthread_join(ponder->thread, NULL);
+  pthread_mutex_destroy(&ponder->shared.mutex);
+  fclose(ponder->shared.log);
+  free(ponder->log_buf);
+}
+
+bool ponder_hit(struct ponder *ponder, struct board *board) {
+  // whether `board` is the position that the pondered principal variation
+  // expects after one turn: every snake is where it moved it, snakes it
+  // expected to die are gone, no food has spawned and hazards are unchanged
+  struct board *prev = &ponder->shared.board;
+  bb_t heads = {0};
+  int p = 0;
+  for (int s = 0; s < MAX_SNAKES; s++) {
+    if (!prev->snakes[s].health)
+      continue;
+    if (p >= ponder->shared.pv_len)
+      return false;
+    unsigned char m = ponder->shared.pv[p++];
+    if (m >= 4) // 4 is a death
+      continue;
+    bb_t head = shift(prev->rules, prev->snakes[s].head, m, prev);
+    if (s == 0 && !bb_any(head & board->snakes->head))
+      return false;
+    heads |= head;
+  }
+  for (int s = 0; s < MAX_SNAKES; s++)
+    if (board->snakes[s].health && !bb_any(board->snakes[s].head & heads))
+      return false;
+  return !bb_any(board->food & ~prev->food | board->hazards ^ prev->hazards);
+}
+
+// state carried over between the turns of a game, so that a search doesn't
+// have to relearn from scratch what the previous search already knew. this
+// only pays off in server mode, as a CGI process doesn't outlive its request.
+// the transposition table is process-wide already, so it isn't part of it
+
+struct game {
+  char id[64]; // raw JSON string literal, quotes included. empty if unused
+  clock_t used; // `wall_clock()` of last use, to evict abandoned games
+  int turn;     // turn of the last search, or -1 if none yet
+  int plies;    // number of live snakes, so number of plies per turn
+  int depth;    // deepest depth completed by the last search
+  unsigned char pv[MAX_DEPTH];
+  int pv_len;
+  short evals[THREADS][MAX_DEPTH][4];
+  struct ponder *ponder; // pondering since the last search, or NULL
+} games[MAX_GAMES];
+pthread_mutex_t games_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+char *game_id(char *req, size_t *len) {
+  // find the game id in a request. returns NULL if it's missing or too long
+  char *j_gid = jsonw_lookup(
+      "id", jsonw_beginobj(jsonw_lookup("game", jsonw_beginobj(req))));
+  char *j_gid_end = jsonw_string(NULL, j_gid);
+  if (!j_gid_end || j_gid_end - j_gid >= sizeof games->id)
+    return NULL;
+  return *len = j_gid_end - j_gid, j_gid;
+}
+
+struct game *game_find(char *id, size_t len, bool create) {
+  // look up the state of a game by id, with `games_mutex` held. if it doesn't
+  // exist and `create` is set, set up a fresh one, evicting the least recently
+  // used game if need be, since `/end` requests sometimes never make it
+  struct game *game = NULL, *lru = games;
+  for (struct game *g = games; g < games + MAX_GAMES; g++) {
+    if (strlen(g->id) == len && memcmp(g->id, id, len) == 0)
+      game = g;
+    // prefer free slots, then the least recently used
+    if (!*g->id ? *lru->id : *lru->id && g->used < lru->used)
+      lru = g;
+  }
+
+  if (!game && create) {
+    game = lru;
+    if (game->ponder)
+      ponder_stop(game->ponder), free(game->ponder);
+    *game = (struct game){.turn = -1};
+    memcpy(game->id, id, len);
+  }
+  if (game)
+    game->used = wall_clock();
+
+  return game;
+}
+
+void game_forget(char *id, size_t len) {
+  // drop the state of a game whose turn was replied to without searching, so
+  // that the next turn neither warm-starts from nor ponders a position that is
+  // a turn out of date
+  pthread_mutex_lock(&games_mutex);
+  struct game *game = game_find(id, len, false);
+  if (game && game->ponder)
+    ponder_stop(game->ponder), free(game->ponder), game->ponder = NULL;
+  if (game)
+    game->turn = -1, game->depth = -1, game->pv_len = 0;
+  pthread_mutex_unlock(&games_mutex);
+}
+
+int start(char *res, size_t size, char *req) {
+  // handle a `/start` request. see `move()` for the calling convention
+  size_t len;
+  char *id = game_id(req, &len);
+  if (id) {
+    pthread_mutex_lock(&games_mutex);
+    game_find(id, len, true);
+    pthread_mutex_unlock(&games_mutex);
+  }
+
+  return snprintf(res, size, "%s", "");
+}
+
+int end(char *res, size_t size, char *req) {
+  // handle an `/end` request. see `move()` for the calling convention
+  size_t len;
+  char *id = game_id(req, &len);
+  if (id) {
+    pthread_mutex_lock(&games_mutex);
+    struct game *game = game_find(id, len, false);
+    if (game && game->ponder)
+      ponder_stop(game->ponder), free(game->ponder), game->ponder = NULL;
+    if (game)
+      *game->id = '\0';
+    pthread_mutex_unlock(&games_mutex);
+  }
+
+  return snprintf(res, size, "%s", "");
+}
+
+// whether `move()` searches under `scheduler`. bin/server turns it on, since
+// it's the one process that sees every search. CGI processes can't see one
+// another, so they keep searching with THREADS threads on any core
+bool scheduling;
+
+void sched_init(void) {
+  // find the cores we're allowed to run on, which may be fewer than the host
+  // has, e.g. in a container
+  scheduler.cores = 0;
+#if defined(__linux__)
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof set, &set) == 0)
+    for (int cpu = 0; cpu < CPU_SETSIZE && scheduler.cores < MAX_CORES; cpu++)
+      if (CPU_ISSET(cpu, &set))
+        scheduler.cpus[scheduler.cores++] = cpu;
+#endif
+  if (!scheduler.cores) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    scheduler.cores = n < 1 ? 1 : n > MAX_CORES ? MAX_CORES : n;
+    for (int c = 0; c < scheduler.cores; c++)
+      scheduler.cpus[c] = c;
+  }
+}
+
+void sched_admit(struct limits *limits) {
+  // admit a search that's about to start: split the cores evenly between the
+  // searches in flight and claim this one's share out of the free cores. if
+  // none are free, the search runs on a single thread on any core. pondering
+  // only gets cores nobody searches on, so if it's in the way, stop it; it
+  // keeps what it found so far
+  pthread_once(&scheduler_once, sched_init);
+  pthread_mutex_lock(&scheduler.mutex);
+  int queue = atomic_fetch_add(&scheduler.searches, 1) + 1;
+  int share = scheduler.cores / queue;
+  share = share < 1 ? 1 : share > limits->threads ? limits->threads : share;
+  uint64_t cores = 0;
+  int n_cores = 0, n_busy = 0;
+  for (int c = 0; c < scheduler.cores; c++)
+    if (scheduler.busy >> c & 1)
+      n_busy++;
+    else if (n_cores < share)
+      cores |= (uint64_t)1 << c, n_cores++;
+  scheduler.busy |= cores;
+  pthread_mutex_unlock(&scheduler.mutex);
+
+  limits->threads = n_cores ? n_cores : 1;
+  limits->cores = cores, limits->queue = queue;
+
+  if (n_busy + n_cores +
+          atomic_load_explicit(&scheduler.pondering, memory_order_relaxed) >
+      scheduler.cores) {
+    pthread_mutex_lock(&games_mutex);
+    for (struct game *g = games; g < games + MAX_GAMES; g++)
+      if (g->ponder && !atomic_exchange(&g->ponder->shared.stop, true))
+        atomic_fetch_add(&scheduler.preempted, 1);
+    pthread_mutex_unlock(&games_mutex);
+  }
+}
+
+void sched_release(struct limits *limits) {
+  // hand back the cores of a search that's over
+  pthread_mutex_lock(&scheduler.mutex);
+  scheduler.busy &= ~limits->cores;
+  atomic_fetch_sub(&scheduler.searches, 1);
+  pthread_mutex_unlock(&scheduler.mutex);
+}
+
+// request parsing. both parsers below fill in the ruleset, width, height, food,
+// hazards and snakes of `board`, as well as `seed`, a hash of the snakes'
+// bodies for `rand_r()`, and `prev_move`, the move we made on the previous
+// turn. they return 0, or -1 after logging why if the request is malformed
+
+struct trace {
+  // where we're at in the body of a snake being parsed
+  signed char hx, hy, tx, ty;
+  unsigned char first; // move that led to the head, 4 if not yet known
+};
+
+void trace_point(struct board *board, struct snake *snake, struct trace *trace,
+                 unsigned char x, unsigned char y, unsigned int *seed) {
+  // add the body part at `x, y` to `snake`, going from head to tail
+  *seed <<= 1, *seed ^= x ^ y;
+  // a step of more than one cell goes around the edge of a wrapped board
+  int d = trace->tx - x + trace->ty - y;
+  bool axis = trace->ty - y != 0,
+       sign = d > 0 != (trace->hx != -1 && (d < -1 || d > 1));
+
+  if (trace->hx == -1 && trace->hy == -1)
+    trace->hx = x, trace->hy = y;
+  else if (trace->first == 4)
+    trace->first = axis << 1 | sign;
+  if (trace->tx == x && trace->ty == y)
+    // several body parts stacked on top of eachother represents tail lag
+    snake->taillag++;
+  trace->tx = x, trace->ty = y;
+
+  // store the path toward the head in `snake.axis` and `snake.sign`
+  snake->body |= bb_bit(x + y * board->width);
+  snake->axis |= axis ? bb_bit(x + y * board->width) : (bb_t){0};
+  snake->sign |= sign ? bb_bit(x + y * board->width) : (bb_t){0};
+}
+
+struct meta {
+  // what a request says besides the board: the raw JSON string literal of the
+  // game id, quotes included, or NULL if it isn't a string, and the turn and
+  // the game's timeout in millis, or -1 and 0 if they aren't numbers
+  char *id, *id_end;
+  double turn, timeout;
+};
+
+int parse_jsonw(struct board *board, struct meta *meta, unsigned int *seed,
+                unsigned char *prev_move, char *req) {
+  // parse a request by looking up every value from the top of the document.
+  // simple but slow, and kept around as a reference for `parse()`, which
+  // bin/bench validates and benchmarks against it
+
+  char *j_game = jsonw_lookup("game", jsonw_beginobj(req));
+  meta->id = jsonw_lookup("id", jsonw_beginobj(j_game));
+  if ((meta->id_end = jsonw_string(NULL, meta->id)) == NULL)
+    meta->id = NULL;
+  meta->turn = -1, meta->timeout = 0;
+  jsonw_number(&meta->turn, jsonw_lookup("turn", jsonw_beginobj(req)));
+  jsonw_number(&meta->timeout,
+               jsonw_lookup("timeout", jsonw_beginobj(j_game)));
+
+  char *j_yid = jsonw_lookup(
+      "id", jsonw_beginobj(jsonw_lookup("you", jsonw_beginobj(req))));
+  char *j_yid_end = jsonw_string(NULL, j_yid);
+  if (!j_yid_end)
+    return fputs("bad you id\n", stderr), -1;
+  ptrdiff_t j_yid_sz = j_yid_end - j_yid;
+
+  // anything amiss with the ruleset falls back to standard rules
+  char *j_ruleset = jsonw_lookup("ruleset", jsonw_beginobj(j_game));
+  char *j_name =
+      jsonw_beginstr(jsonw_lookup("name", jsonw_beginobj(j_ruleset)));
+  for (unsigned char r = 0; r < sizeof rulesets / sizeof *rulesets; r++)
+    if (j_name && jsonw_strcmp(rulesets[r], j_name) == 0)
+      board->rules = r;
+  board->hazard_damage = HAZARD_DAMAGE;
+  jsonw_uchar(&board->hazard_damage,
+              jsonw_lookup("hazardDamagePerTurn",
+                           jsonw_beginobj(jsonw_lookup(
+                               "settings", jsonw_beginobj(j_ruleset)))));
+
+  char *j_board = jsonw_lookup("board", jsonw_beginobj(req));
+  if (!jsonw_uchar(&board->width,
+                   jsonw_lookup("width", jsonw_beginobj(j_board))))
+    return fputs("bad board width\n", stderr), -1;
+  if (!jsonw_uchar(&board->height,
+                   jsonw_lookup("height", jsonw_beginobj(j_board))))
+    return fputs("bad board height\n", stderr), -1;
+  if (board->width * board->height > CELLS)
+    return fputs("board too large\n", stderr), -1;
+#if defined(WIDE)
+  if (board->width >= 64) // see `bb_shl()`
+    return fputs("board too wide\n", stderr), -1;
+#endif
+
+  char *j_food = jsonw_lookup("food", jsonw_beginobj(j_board));
+  for (char *j_point = jsonw_beginarr(j_food); j_point && *j_point != ']';
+       j_point = jsonw_element(j_point)) {
+    unsigned char x, y;
+    if (!jsonw_uchar(&x, jsonw_lookup("x", jsonw_beginobj(j_point))))
+      return fputs("bad food x\n", stderr), -1;
+    if (!jsonw_uchar(&y, jsonw_lookup("y", jsonw_beginobj(j_point))))
+      return fputs("bad food y\n", stderr), -1;
+    if (x >= board->width || y >= board->height)
+      return fputs("bad food point\n", stderr), -1;
+
+    board->food |= bb_bit(x + y * board->width);
+  }
+
+  char *j_hazards = jsonw_lookup("hazards", jsonw_beginobj(j_board));
+  for (char *j_point = jsonw_beginarr(j_hazards); j_point && *j_point != ']';
+       j_point = jsonw_element(j_point)) {
+    unsigned char x, y;
+    if (!jsonw_uchar(&x, jsonw_lookup("x", jsonw_beginobj(j_point))))
+      return fputs("bad hazard x\n", stderr), -1;
+    if (!jsonw_uchar(&y, jsonw_lookup("y", jsonw_beginobj(j_point))))
+      return fputs("bad hazard y\n", stderr), -1;
+    if (x >= board->width || y >= board->height)
+      return fputs("bad hazard point\n", stderr), -1;
+
+    board->hazards |= bb_bit(x + y * board->width);
+  }
+
+  int s = 1;
+  char *j_snakes = jsonw_lookup("snakes", jsonw_beginobj(j_board));
+  for (char *j_snake = jsonw_beginarr(j_snakes); j_snake && *j_snake != ']';
+       j_snake = jsonw_element(j_snake)) {
 
     char *j_id = jsonw_lookup("id", jsonw_beginobj(j_snake));
     char *j_id_end = jsonw_string(NULL, j_id);
     if (!j_id_end)
-      fputs("bad snake id\n", stderr), exit(EXIT_FAILURE);
+      return fputs("bad snake id\n", stderr), -1;
     ptrdiff_t j_id_sz = j_id_end - j_id;
 
     bool is_you = j_yid_sz == j_id_sz && memcmp(j_yid, j_id, j_yid_sz) == 0;
-    struct snake *snake = is_you ? board.snakes : board.snakes + s++;
+    struct snake *snake = is_you ? board->snakes : board->snakes + s++;
     if (s > MAX_SNAKES)
-      fputs("too many snakes\n", stderr), exit(EXIT_FAILURE);
+      return fputs("too many snakes\n", stderr), -1;
+    if (bb_any(snake->body))
+      return fputs("duplicate snake id\n", stderr), -1;
 
     if (!jsonw_uchar(&snake->length,
                      jsonw_lookup("length", jsonw_beginobj(j_snake))))
-      fputs("bad snake length\n", stderr), exit(EXIT_FAILURE);
+      return fputs("bad snake length\n", stderr), -1;
     if (!jsonw_uchar(&snake->health,
                      jsonw_lookup("health", jsonw_beginobj(j_snake))))
-      fputs("bad snake health\n", stderr), exit(EXIT_FAILURE);
-
-    signed char hx = -1, hy = -1, tx = -1, ty = -1;
+      return fputs("bad snake health\n", stderr), -1;
 
+    struct trace trace = {-1, -1, -1, -1, 4};
     char *j_body = jsonw_lookup("body", jsonw_beginobj(j_snake));
-    for (char *j_point = jsonw_beginarr(j_body); j_point;
+    for (char *j_point = jsonw_beginarr(j_body); j_point && *j_point != ']';
          j_point = jsonw_element(j_point)) {
       unsigned char x, y;
       if (!jsonw_uchar(&x, jsonw_lookup("x", jsonw_beginobj(j_point))))
-        fputs("bad body x\n", stderr), exit(EXIT_FAILURE);
+        return fputs("bad body x\n", stderr), -1;
       if (!jsonw_uchar(&y, jsonw_lookup("y", jsonw_beginobj(j_point))))
-        fputs("bad body y\n", stderr), exit(EXIT_FAILURE);
-      if (x > board.width || y > board.height)
-        fputs("bad body point\n", stderr), exit(EXIT_FAILURE);
-
-      seed <<= 1, seed ^= x ^ y;
-      bool axis = ty - y != 0, sign = tx - x + ty - y > 0;
-
-      if (hx == -1 && hy == -1)
-        hx = x, hy = y;
-      else if (is_you && prev_move == 4)
-        prev_move = axis << 1 | sign;
-      if (tx == x && ty == y)
-        // several body parts stacked on top of eachother represents tail lag
-        snake->taillag++;
-      tx = x, ty = y;
-
-      // store the path toward the head in `snake.axis` and `snake.sign`
-      snake->body |= (bb_t)1 << x + y * board.width;
-      snake->axis |= (bb_t)axis << x + y * board.width;
-      snake->sign |= (bb_t)sign << x + y * board.width;
+        return fputs("bad body y\n", stderr), -1;
+      if (x >= board->width || y >= board->height)
+        return fputs("bad body point\n", stderr), -1;
+
+      trace_point(board, snake, &trace, x, y, seed);
     }
+    if (trace.hx == -1)
+      return fputs("bad snake body\n", stderr), -1;
 
-    snake->head = (bb_t)1 << hx + hy * board.width;
-    snake->tail = (bb_t)1 << tx + ty * board.width;
+    if (is_you)
+      *prev_move = trace.first;
+    snake->head = bb_bit(trace.hx + trace.hy * board->width);
+    snake->tail = bb_bit(trace.tx + trace.ty * board->width);
+  }
+
+  return 0;
+}
+
+// `parse()` goes over the request once, front to back, and builds the board as
+// it goes. values are parsed in place rather than copied out, and values it has
+// no use for are skipped over, though still validated. every function takes a
+// pointer to the beginning of a value and returns a pointer past its end, or
+// NULL if it's malformed. a NULL pointer in gives a NULL pointer out
+
+char *parse_string(char *json) {
+  // skip over a string literal
+  if (json == NULL || *json != '"')
+    return NULL;
+  for (json++; *json != '"'; json++) {
+    if ((unsigned char)*json < ' ') // including the NUL terminator
+      return NULL;
+    if (*json != '\\')
+      continue;
+    if (*++json == 'u') {
+      for (int i = 0; i < 4; i++)
+        if (!isxdigit((unsigned char)*++json))
+          return NULL;
+    } else if (!*json || !strchr("\"\\/bfnrt", *json))
+      return NULL;
+  }
+  return json + 1;
+}
+
+char *parse_name(char *json) {
+  // skip over the name of an object member, up to its value
+  json = jsonw_ws(parse_string(json));
+  return json && *json == ':' ? jsonw_ws(json + 1) : NULL;
+}
+
+bool parse_is(char *key, char *name) {
+  // whether the string literal at `name` spells out `key`. escapes are rare,
+  // so only decode them, slowly, if we run into one
+  for (name++; *key && *key == *name; key++, name++)
+    ;
+  return *name == '\\' ? jsonw_strcmp(key, name) == 0 : !*key && *name == '"';
+}
+
+char *parse_open(char open, char *json) {
+  // move past `open` onto the first element or member, or the closing bracket
+  return json && *json == open ? jsonw_ws(json + 1) : NULL;
+}
+
+char *parse_next(char close, char *json) {
+  // move past a separator onto the next element or member, or onto `close`
+  json = jsonw_ws(json);
+  if (json && *json == ',')
+    return *(json = jsonw_ws(json + 1)) != close ? json : NULL;
+  return json && *json == close ? json : NULL;
+}
+
+char *parse_skip(char *json, int nesting) {
+  // skip over any value, nested at most MAX_NESTING deep
+  if (json == NULL || nesting > MAX_NESTING)
+    return NULL;
+  if (*json == '"')
+    return parse_string(json);
+  if (*json == '[' || *json == '{') {
+    char close = *json + 2; // ']' and '}' in ASCII
+    for (json = parse_open(*json, json); json && *json != close;
+         json = parse_next(close, json))
+      json = parse_skip(close == '}' ? parse_name(json) : json, nesting + 1);
+    return json ? json + 1 : NULL;
+  }
+  char *j;
+  (j = jsonw_null(json)) || (j = jsonw_boolean(NULL, json)) ||
+      (j = jsonw_number(NULL, json));
+  return j;
+}
+
+char *parse_point(struct board *board, unsigned char *x, unsigned char *y,
+                  char *json) {
+  // parse a point on the board, like `{"x": 1, "y": 2}`
+  bool has_x = false, has_y = false;
+  for (json = parse_open('{', json); json && *json != '}';
+       json = parse_next('}', json)) {
+    char *value = parse_name(json);
+    if (!has_x && parse_is("x", json))
+      has_x = true, json = jsonw_uchar(x, value);
+    else if (!has_y && parse_is("y", json))
+      has_y = true, json = jsonw_uchar(y, value);
+    else
+      json = parse_skip(value, 0);
+  }
+  return json && has_x && has_y && *x < board->width && *y < board->height
+             ? json + 1
+             : NULL;
+}
+
+char *parse_cells(struct board *board, bb_t *cells, char *json) {
+  // parse an array of points, like `food` or `hazards`, once the board's
+  // dimensions are known
+  for (json = parse_open('[', json); json && *json != ']';
+       json = parse_next(']', json)) {
+    unsigned char x, y;
+    if ((json = parse_point(board, &x, &y, json)))
+      *cells |= bb_bit(x + y * board->width);
+  }
+  return json ? json + 1 : NULL;
+}
+
+// snakes are parsed before we know which one is us, so they're held on to along
+// with the raw JSON string literal of their id
+struct parsed {
+  struct snake snake;
+  struct trace trace;
+  char *id, *id_end;
+};
+
+char *parse_body(struct board *board, struct parsed *parsed,
+                 unsigned int *seed, char *json) {
+  // parse the body of a snake, from head to tail
+  for (json = parse_open('[', json); json && *json != ']';
+       json = parse_next(']', json)) {
+    unsigned char x, y;
+    if ((json = parse_point(board, &x, &y, json)))
+      trace_point(board, &parsed->snake, &parsed->trace, x, y, seed);
+  }
+  return json && parsed->trace.hx != -1 ? json + 1 : NULL;
+}
+
+char *parse_snake(struct board *board, struct parsed *parsed,
+                  unsigned int *seed, char *json) {
+  // parse a snake, once the board's dimensions are known
+  bool has_length = false, has_health = false, has_body = false;
+  for (json = parse_open('{', json); json && *json != '}';
+       json = parse_next('}', json)) {
+    char *value = parse_name(json);
+    if (!parsed->id && parse_is("id", json))
+      parsed->id = value, json = parsed->id_end = parse_string(value);
+    else if (!has_length && parse_is("length", json))
+      has_length = true, json = jsonw_uchar(&parsed->snake.length, value);
+    else if (!has_health && parse_is("health", json))
+      has_health = true, json = jsonw_uchar(&parsed->snake.health, value);
+    else if (!has_body && parse_is("body", json))
+      has_body = true, json = parse_body(board, parsed, seed, value);
+    else
+      json = parse_skip(value, 0);
+  }
+  return json && parsed->id && has_length && has_health && has_body ? json + 1
+                                                                    : NULL;
+}
+
+char *parse_snakes(struct board *board, struct parsed *parsed, int *n_parsed,
+                   unsigned int *seed, char *json) {
+  // parse the `snakes` array, once the board's dimensions are known. there
+  // can be one snake too many, so that `parse()` can tell whether it's us
+  for (json = parse_open('[', json); json && *json != ']';
+       json = parse_next(']', json)) {
+    if (*n_parsed == MAX_SNAKES + 1)
+      return NULL;
+    parsed[*n_parsed] = (struct parsed){.trace = {-1, -1, -1, -1, 4}};
+    json = parse_snake(board, parsed + (*n_parsed)++, seed, json);
+  }
+  return json ? json + 1 : NULL;
+}
+
+char *parse_unfit(struct board *board) {
+  // why a board of these dimensions can't be searched, or NULL if it can
+  if (board->width * board->height > CELLS)
+    return "board too large";
+#if defined(WIDE)
+  if (board->width >= 64) // see `bb_shl()`
+    return "board too wide";
+#endif
+  return NULL;
+}
+
+char *parse_board(struct board *board, struct parsed *parsed, int *n_parsed,
+                  unsigned int *seed, char **error, char *json) {
+  // parse the board. food and snakes can only be placed on the board once its
+  // dimensions are known, so should they come first, which they don't in
+  // practice, skip over them and come back to them at the end
+  bool has_width = false, has_height = false;
+  bool has_food = false, has_hazards = false, has_snakes = false;
+  // where to come back to, if anywhere
+  char *food = NULL, *hazards = NULL, *snakes = NULL;
+  for (json = parse_open('{', json); json && *json != '}';
+       json = parse_next('}', json)) {
+    char *value = parse_name(json);
+    bool ready = has_width && has_height && !parse_unfit(board);
+    if (!has_width && parse_is("width", json))
+      has_width = true, json = jsonw_uchar(&board->width, value);
+    else if (!has_height && parse_is("height", json))
+      has_height = true, json = jsonw_uchar(&board->height, value);
+    else if (!has_food && parse_is("food", json))
+      has_food = true,
+      json = ready ? parse_cells(board, &board->food, value)
+                   : parse_skip(food = value, 0);
+    else if (!has_hazards && parse_is("hazards", json))
+      has_hazards = true,
+      json = ready ? parse_cells(board, &board->hazards, value)
+                   : parse_skip(hazards = value, 0);
+    else if (!has_snakes && parse_is("snakes", json))
+      has_snakes = true,
+      json = ready ? parse_snakes(board, parsed, n_parsed, seed, value)
+                   : parse_skip(snakes = value, 0);
+    else
+      json = parse_skip(value, 0);
+  }
+
+  if (json == NULL)
+    return NULL;
+  if (!has_width || !has_height)
+    return *error = has_width ? "bad board height" : "bad board width", NULL;
+  if (parse_unfit(board))
+    return *error = parse_unfit(board), NULL;
+  if (food && !parse_cells(board, &board->food, food) ||
+      hazards && !parse_cells(board, &board->hazards, hazards) ||
+      snakes && !parse_snakes(board, parsed, n_parsed, seed, snakes))
+    return *error = "malformed request", NULL;
+  return json + 1;
+}
+
+char *parse_settings(struct board *board, char *json) {
+  // parse the ruleset's settings, or skip over them if they aren't an object
+  if (json == NULL || *json != '{')
+    return parse_skip(json, 0);
+  bool has_damage = false;
+  for (json = parse_open('{', json); json && *json != '}';
+       json = parse_next('}', json)) {
+    char *value = parse_name(json), *end;
+    if (!has_damage && parse_is("hazardDamagePerTurn", json))
+      has_damage = true,
+      json = (end = jsonw_uchar(&board->hazard_damage, value))
+                 ? end
+                 : parse_skip(value, 0);
+    else
+      json = parse_skip(value, 0);
+  }
+  return json ? json + 1 : NULL;
+}
+
+char *parse_ruleset(struct board *board, char *json) {
+  // parse the ruleset, or skip over it if it isn't an object. anything amiss
+  // falls back to standard rules
+  if (json == NULL || *json != '{')
+    return parse_skip(json, 0);
+  bool has_name = false, has_settings = false;
+  for (json = parse_open('{', json); json && *json != '}';
+       json = parse_next('}', json)) {
+    char *value = parse_name(json);
+    if (!has_name && parse_is("name", json)) {
+      has_name = true;
+      for (unsigned char r = 0; r < sizeof rulesets / sizeof *rulesets; r++)
+        if (value && *value == '"' && parse_is(rulesets[r], value))
+          board->rules = r;
+      json = parse_skip(value, 0);
+    } else if (!has_settings && parse_is("settings", json))
+      has_settings = true, json = parse_settings(board, value);
+    else
+      json = parse_skip(value, 0);
+  }
+  return json ? json + 1 : NULL;
+}
+
+char *parse_game(struct board *board, struct meta *meta, char *json) {
+  // parse the game, or skip over it if it isn't an object. the id and timeout
+  // are only kept if they're a string and a number
+  if (json == NULL || *json != '{')
+    return parse_skip(json, 0);
+  bool has_id = false, has_timeout = false, has_ruleset = false;
+  for (json = parse_open('{', json); json && *json != '}';
+       json = parse_next('}', json)) {
+    char *value = parse_name(json), *end;
+    if (!has_id && parse_is("id", json))
+      has_id = true, json = value && *value == '"'
+                                ? (meta->id = value, meta->id_end =
+                                                         parse_string(value))
+                                : parse_skip(value, 0);
+    else if (!has_timeout && parse_is("timeout", json))
+      has_timeout = true,
+      json = (end = jsonw_number(&meta->timeout, value))
+                 ? end
+                 : parse_skip(value, 0);
+    else if (!has_ruleset && parse_is("ruleset", json))
+      has_ruleset = true, json = parse_ruleset(board, value);
+    else
+      json = parse_skip(value, 0);
+  }
+  return json ? json + 1 : NULL;
+}
+
+char *parse_you(char **id, char **id_end, char *json) {
+  // parse our own snake, of which only the id matters
+  for (json = parse_open('{', json); json && *json != '}';
+       json = parse_next('}', json)) {
+    char *value = parse_name(json);
+    if (!*id && parse_is("id", json))
+      *id = value, json = *id_end = parse_string(value);
+    else
+      json = parse_skip(value, 0);
+  }
+  return json ? json + 1 : NULL;
+}
+
+int parse(struct board *board, struct meta *meta, unsigned int *seed,
+          unsigned char *prev_move, char *req) {
+  // parse a request in a single pass. see example-move.json. `meta` may be
+  // NULL if only the board matters
+  struct parsed parsed[MAX_SNAKES + 1];
+  int n_parsed = 0;
+  char *you = NULL, *you_end = NULL, *error = "malformed request";
+  bool has_game = false, has_turn = false, has_board = false, has_you = false;
+  struct meta local;
+  meta = meta ? meta : &local;
+  *meta = (struct meta){.turn = -1};
+  board->hazard_damage = HAZARD_DAMAGE;
+  char *json = jsonw_ws(req);
+  for (json = parse_open('{', json); json && *json != '}';
+       json = parse_next('}', json)) {
+    char *value = parse_name(json), *end;
+    if (!has_game && parse_is("game", json))
+      has_game = true, json = parse_game(board, meta, value);
+    else if (!has_turn && parse_is("turn", json))
+      has_turn = true, json = (end = jsonw_number(&meta->turn, value))
+                                  ? end
+                                  : parse_skip(value, 0);
+    else if (!has_board && parse_is("board", json))
+      has_board = true,
+      json = parse_board(board, parsed, &n_parsed, seed, &error, value);
+    else if (!has_you && parse_is("you", json))
+      has_you = true, json = parse_you(&you, &you_end, value);
+    else
+      json = parse_skip(value, 0);
+  }
+
+  if (json == NULL || *jsonw_ws(json + 1))
+    return fprintf(stderr, "%s\n", error), -1;
+  if (!has_board)
+    return fputs("bad board width\n", stderr), -1;
+  if (you_end == NULL)
+    return fputs("bad you id\n", stderr), -1;
+
+  // now that we know which snake is us, put it first
+  struct parsed *yours = NULL;
+  for (struct parsed *p = parsed; p < parsed + n_parsed; p++)
+    if (p->id_end - p->id == you_end - you &&
+        memcmp(p->id, you, you_end - you) == 0) {
+      if (yours)
+        return fputs("duplicate snake id\n", stderr), -1;
+      yours = p;
+    }
+  if (n_parsed - !!yours > MAX_SNAKES - 1)
+    return fputs("too many snakes\n", stderr), -1;
+
+  int s = 1;
+  for (struct parsed *p = parsed; p < parsed + n_parsed; p++) {
+    struct snake *snake = p == yours ? board->snakes : board->snakes + s++;
+    *snake = p->snake;
+    snake->head = bb_bit(p->trace.hx + p->trace.hy * board->width);
+    snake->tail = bb_bit(p->trace.tx + p->trace.ty * board->width);
+  }
+  if (yours)
+    *prev_move = yours->trace.first;
+
+  return 0;
+}
+
+// telemetry: one JSON line per search, appended to TELEMETRY, and histograms
+// of latency and depth over every search this process has run, which
+// `telemetry_dump()` writes out on demand. both are fed once per request from
+// `struct stats`, so they cost nothing during the search itself, and finished
+// off once the reply has gone out, so they don't delay it either
+
+struct histograms {
+  atomic_int requests;
+  atomic_int latency[1000 * TOTAL_TIME / LATENCY_BUCKET + 1]; // last overflows
+  atomic_int forced;               // searches that had a single legal move
+  atomic_int unfinished;           // searches that didn't complete any depth
+  atomic_int booked;               // replies straight from the opening book
+  atomic_int depth[MAX_DEPTH + 1]; // searches by deepest depth completed
+  // pondered turns whose position was the expected one or not, and hits by
+  // number of depths pondering gained over the previous reply
+  atomic_int hits, misses, gained[MAX_DEPTH + 1];
+  // searches by number of searches in flight when they were admitted, see
+  // `sched_admit()`, and replies that took longer than the round-trip timeout
+  atomic_int queue[MAX_GAMES + 1]; // last overflows
+  atomic_int late;
+} histograms;
+FILE *telemetry_file;
+pthread_once_t telemetry_once = PTHREAD_ONCE_INIT;
+
+// whether JSON lines are appended to TELEMETRY. bin/server turns it on, while
+// bin/move, which bin/selfplay runs once per move, only does with the
+// SANDWORM_TELEMETRY environment variable set. histograms are kept regardless
+bool telemetering;
+
+void telemetry_open(void) {
+  // appending a line in a single `write()` keeps lines whole even when several
+  // CGI processes share the file
+  if (telemetering && *TELEMETRY &&
+      (telemetry_file = fopen(TELEMETRY, "a")) == NULL)
+    perror(TELEMETRY);
+}
+
+// the record of the last search on this thread, held back until its reply has
+// gone out. see `telemetry_flush()`
+_Thread_local struct {
+  bool pending;
+  clock_t start, total_time;
+  FILE *json; // the JSON line so far, or NULL if there's no file to write to
+  char *line;
+  size_t len;
+} record;
+
+void telemetry(struct meta *meta, struct board *board, struct stats *stats,
+               clock_t start, struct limits *limits) {
+  // record the search described by `stats`, which started at `start` within
+  // `limits`. the latency and the JSON line are only finished off by
+  // `telemetry_flush()`, once the reply is out
+  if (record.json)
+    fclose(record.json), free(record.line);
+  record.pending = !limits->quiet, record.json = NULL;
+  record.start = start, record.total_time = limits->total_time;
+
+  atomic_fetch_add(&histograms.requests, 1);
+  if (limits->queue)
+    atomic_fetch_add(histograms.queue + (limits->queue < MAX_GAMES
+                                             ? limits->queue
+                                             : MAX_GAMES),
+                     1);
+  atomic_fetch_add(stats->booked      ? &histograms.booked
+                   : stats->forced    ? &histograms.forced
+                   : stats->depth < 0 ? &histograms.unfinished
+                                      : histograms.depth + stats->depth,
+                   1);
+  if (stats->pondered)
+    atomic_fetch_add(stats->hit ? &histograms.hits : &histograms.misses, 1);
+  if (stats->hit && stats->gained >= 0)
+    atomic_fetch_add(histograms.gained + stats->gained, 1);
+
+  if (limits->quiet)
+    return;
+  pthread_once(&telemetry_once, telemetry_open);
+  if (telemetry_file == NULL)
+    return;
+
+  FILE *json = open_memstream(&record.line, &record.len);
+  if (json == NULL) {
+    perror("open_memstream");
+    return;
+  }
+
+  int snakes = 0;
+  for (int s = 0; s < MAX_SNAKES; s++)
+    snakes += !!board->snakes[s].health;
+
+  // effective branching factor, from the nodes searched by the time each of
+  // the deepest two depths completed. null if either was skipped over or
+  // warm-started past
+  int d = stats->depth;
+  double ebf = d > 0 && stats->depth_nodes[d] && stats->depth_nodes[d - 1]
+                   ? (double)stats->depth_nodes[d] / stats->depth_nodes[d - 1]
+                   : 0;
+
+  fprintf(json, "{\"game\":%.*s,\"turn\":%.0f,\"snakes\":%d,",
+          meta->id ? (int)(meta->id_end - meta->id) : 4,
+          meta->id ? meta->id : "null", meta->turn, snakes);
+  fprintf(json, "\"width\":%d,\"height\":%d,\"depth\":%d,\"micros\":[",
+          board->width, board->height, d);
+  for (int t = 0; t <= d; t++)
+    stats->time[t]
+        ? fprintf(json, &",%lld"[!t],
+                  (long long)stats->time[t] * 1000000 / CLOCKS_PER_SEC)
+        : fprintf(json, &",null"[!t]);
+  fprintf(json, "],\"nodes\":%lld,\"evals\":%lld,\"betas\":%lld,",
+          stats->nodes, stats->evals, stats->betas);
+  ebf ? fprintf(json, "\"ebf\":%.3f,", ebf) : fprintf(json, "\"ebf\":null,");
+  stats->pondered ? fprintf(json, "\"ponder\":{\"hit\":%s,\"gained\":%d},",
+                            stats->hit ? "true" : "false", stats->gained)
+                  : fprintf(json, "\"ponder\":null,");
+  fprintf(json, "\"threads\":%d,\"queue\":%d,\"book\":%s,", stats->threads,
+          limits->queue, stats->booked ? "true" : "false");
+  fprintf(json, "\"move\":\"%s\",",
+          (char *[]){"left", "right", "down", "up"}[stats->move]);
+  record.json = json;
+}
+
+void telemetry_flush(void) {
+  // finish off the record of the last search on this thread, once its reply
+  // has been written out. that's when the time to first byte is known, and
+  // appending to TELEMETRY then doesn't hold up the reply
+  if (!record.pending)
+    return;
+  record.pending = false;
+  clock_t ttfb = wall_clock() - record.start;
+  if (ttfb > record.total_time)
+    atomic_fetch_add(&histograms.late, 1);
+  int bucket = ttfb * 1000 / CLOCKS_PER_SEC / LATENCY_BUCKET;
+  int n_buckets = sizeof histograms.latency / sizeof *histograms.latency;
+  atomic_fetch_add(histograms.latency +
+                       (bucket < n_buckets ? bucket : n_buckets - 1),
+                   1);
+
+  if (record.json == NULL)
+    return;
+  fprintf(record.json, "\"ttfb\":%lld}\n",
+          (long long)ttfb * 1000000 / CLOCKS_PER_SEC);
+  fclose(record.json), record.json = NULL;
+  flockfile(telemetry_file);
+  fwrite(record.line, 1, record.len, telemetry_file);
+  fflush(telemetry_file);
+  funlockfile(telemetry_file);
+  free(record.line);
+}
+
+void telemetry_dump(FILE *file) {
+  // write out the histograms as a line of JSON. latencies are in buckets of
+  // LATENCY_BUCKET milliseconds, and depths and depths gained by pondering
+  // are indexed by depth
+  fprintf(file, "{\"requests\":%d,\"latency_bucket\":%d,\"latency\":[",
+          atomic_load(&histograms.requests), LATENCY_BUCKET);
+  for (size_t b = 0; b < sizeof histograms.latency / sizeof *histograms.latency;
+       b++)
+    fprintf(file, &",%d"[!b], atomic_load(histograms.latency + b));
+  fprintf(file, "],\"forced\":%d,\"booked\":%d,\"unfinished\":%d,\"depth\":[",
+          atomic_load(&histograms.forced), atomic_load(&histograms.booked),
+          atomic_load(&histograms.unfinished));
+  for (int d = 0; d <= MAX_DEPTH; d++)
+    fprintf(file, &",%d"[!d], atomic_load(histograms.depth + d));
+  fprintf(file, "],\"ponder_hits\":%d,\"ponder_misses\":%d,\"gained\":[",
+          atomic_load(&histograms.hits), atomic_load(&histograms.misses));
+  for (int d = 0; d <= MAX_DEPTH; d++)
+    fprintf(file, &",%d"[!d], atomic_load(histograms.gained + d));
+  fprintf(file, "],\"late\":%d,\"preempted\":%d,\"queue\":[",
+          atomic_load(&histograms.late), atomic_load(&scheduler.preempted));
+  for (int q = 0; q <= MAX_GAMES; q++)
+    fprintf(file, &",%d"[!q], atomic_load(histograms.queue + q));
+  fprintf(file, "]}\n");
+  fflush(file);
+}
+
+// opening book: standard games start from a handful of spawn layouts, so
+// bin/book searches those ahead of time, much deeper than a live search can
+// afford, and `think()` replies from the book when it has the position. the
+// book is a header followed by entries sorted by key, memory-mapped once and
+// binary searched. boards that are mirror images or rotations of each other
+// play the same, so keys are taken over whichever symmetry hashes lowest, and
+// moves are stored in that same frame
+
+struct book_header {
+  char magic[8];   // BOOK_MAGIC, which also changes with the format
+  uint64_t layout; // see `book_layout()`
+  uint64_t n_entries;
+};
+
+struct book_entry {
+  uint64_t key; // see `book_key()`
+  short eval;   // eval of the search that picked `move`
+  unsigned char move, depth;
+  uint32_t pad; // keep the layout the same everywhere
+};
+
+#define BOOK_MAGIC "SWBOOK2"
+#define BOOK_SYMS 8 // bit 0 flips x, bit 1 flips y and bit 2 transposes
+
+struct {
+  struct book_entry *entries;
+  size_t n_entries;
+} book;
+pthread_once_t book_once = PTHREAD_ONCE_INIT;
+
+int book_cell(struct board *board, int cell, int sym) {
+  // where `cell` lands on a board transformed by symmetry `sym`
+  int x = cell % board->width, y = cell / board->width;
+  if (sym & 4) {
+    int t = x;
+    x = y, y = t;
+  }
+  x = sym & 1 ? board->width - 1 - x : x;
+  y = sym & 2 ? board->height - 1 - y : y;
+  return y * board->width + x;
+}
+
+unsigned char book_move(unsigned char move, int sym) {
+  // where `move` points on a board transformed by symmetry `sym`
+  int dx = move < 2 ? (move & 1 ? 1 : -1) : 0;
+  int dy = move < 2 ? 0 : (move & 1 ? 1 : -1);
+  if (sym & 4) {
+    int t = dx;
+    dx = dy, dy = t;
+  }
+  dx = sym & 1 ? -dx : dx, dy = sym & 2 ? -dy : dy;
+  return dx ? dx > 0 : 2 | dy > 0;
+}
+
+uint64_t book_key(struct board *board, int sym) {
+  // hash a board transformed by symmetry `sym`. it's a Zobrist hash like
+  // `zobrist_hash()`, except that it includes lengths, health, stacked tails
+  // and the path each body takes from its tail to its head, since bodies
+  // covering the same cells can still pull their tails away differently, and
+  // that opponents are hashed alike, so that their order in the request
+  // doesn't matter
+  uint64_t key = bb_hash((bb_t){0}, board->width << 8 | board->height);
+  for (int s = 0; s < MAX_SNAKES; s++) {
+    struct snake *snake = board->snakes + s;
+    if (!snake->health)
+      continue;
+    uint64_t head = zobrist.head[!!s][book_cell(board, bb_ctz(snake->head),
+                                                sym)];
+    key ^= bb_hash((bb_t){0}, head ^ snake->length << 16 ^
+                                  snake->health << 8 ^ snake->taillag);
+    for (bb_t body = snake->body & ~snake->head; bb_any(body);) {
+      int cell = bb_ctz(body);
+      int move = bb_any(snake->axis & bb_bit(cell)) << 1 |
+                 bb_any(snake->sign & bb_bit(cell));
+      key ^= bb_hash((bb_t){0}, zobrist.body[!!s][book_cell(board, cell, sym)] ^
+                                    book_move(move, sym));
+      body &= ~bb_bit(cell);
+    }
+    key ^= zobrist.body[!!s][book_cell(board, bb_ctz(snake->head), sym)];
+  }
+  for (bb_t food = board->food; bb_any(food);) {
+    int cell = bb_ctz(food);
+    key ^= zobrist.food[book_cell(board, cell, sym)], food &= ~bb_bit(cell);
+  }
+  return key;
+}
+
+uint64_t book_layout(void) {
+  // what keys depend on besides the board: the number of cells and snakes,
+  // which decide where each Zobrist key sits, and the keys themselves. a book
+  // written by a build where any of them differ, such as bin/move-wide, has
+  // keys that mean nothing to this one
+  pthread_once(&zobrist_once, zobrist_init);
+  uint64_t layout = bb_hash((bb_t){0}, CELLS << 16 ^ MAX_SNAKES << 8);
+  layout = bb_hash((bb_t){0}, layout ^ zobrist.head[0][0]);
+  layout = bb_hash((bb_t){0}, layout ^ zobrist.body[1][CELLS - 1]);
+  return bb_hash((bb_t){0}, layout ^ zobrist.food[CELLS - 1]);
+}
+
+int book_canon(struct board *board, uint64_t *key) {
+  // the symmetry whose key is lowest, and that key. boards that aren't square
+  // can't be transposed
+  int canon = 0;
+  *key = book_key(board, 0);
+  for (int sym = 1; sym < (board->width == board->height ? 8 : 4); sym++) {
+    uint64_t k = book_key(board, sym);
+    if (k < *key)
+      *key = k, canon = sym;
+  }
+  return canon;
+}
+
+void book_open(void) {
+  // map BOOK into memory. a missing book is no error, it just never hits
+  int fd = *BOOK ? open(BOOK, O_RDONLY) : -1;
+  if (fd == -1) {
+    if (*BOOK && errno != ENOENT)
+      perror(BOOK);
+    return;
+  }
+  struct stat st;
+  void *map = fstat(fd, &st) == 0 && st.st_size >= sizeof(struct book_header)
+                  ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)
+                  : MAP_FAILED;
+  close(fd);
+  if (map == MAP_FAILED) {
+    fputs("bad book\n", stderr);
+    return;
+  }
+  struct book_header *header = map;
+  if (memcmp(header->magic, BOOK_MAGIC, sizeof header->magic) != 0 ||
+      header->n_entries > (st.st_size - sizeof *header) /
+                              sizeof(struct book_entry)) {
+    fputs("bad book\n", stderr), munmap(map, st.st_size);
+    return;
+  }
+  if (header->layout != book_layout()) {
+    fputs("book built for another board layout\n", stderr);
+    munmap(map, st.st_size);
+    return;
+  }
+  book.entries = (struct book_entry *)(header + 1);
+  book.n_entries = header->n_entries;
+}
+
+struct book_entry *book_probe(struct board *board, unsigned char *move) {
+  // look up a board in the opening book. returns NULL if it isn't there, or
+  // the entry and, in `move`, its move turned back into the board's frame
+  pthread_once(&book_once, book_open);
+  if (!book.n_entries || board->rules != RULES_STANDARD ||
+      bb_any(board->hazards))
+    return NULL;
+  uint64_t key;
+  int sym = book_canon(board, &key);
+  size_t lo = 0, hi = book.n_entries;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (book.entries[mid].key < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == book.n_entries || book.entries[lo].key != key)
+    return NULL;
+  for (unsigned char m = 0; m < 4; m++)
+    if (book_move(m, sym) == book.entries[lo].move)
+      *move = m;
+  return book.entries + lo;
+}
+
+void prepare(struct board *board) {
+  // fill in the parts of a freshly parsed board that aren't in the request
+  board->board = bb_mask(board->width * board->height);
+  for (unsigned char y = 0; y < board->height; y++)
+    board->xmask = bb_shl(board->xmask, board->width) | bb_bit(0);
+  board->xmask = board->board & ~board->xmask;
+  board->bodies = (bb_t){0};
+  for (int s = 0; s < MAX_SNAKES; s++)
+    if (board->snakes[s].health)
+      board->bodies |= board->snakes[s].body;
+  // hazard maps are played under standard rules, which then work the same as
+  // royale rules. under constrictor rules, food is moot, since every snake
+  // grows and heals on every move anyway
+  if (board->rules == RULES_STANDARD && bb_any(board->hazards) &&
+      board->hazard_damage)
+    board->rules = RULES_ROYALE;
+  if (board->rules == RULES_CONSTRICTOR)
+    board->food = (bb_t){0};
+  board->kernel = kernels + sizeof kernels / sizeof *kernels - 1;
+  for (struct kernel *k = kernels; k < board->kernel; k++)
+    if (k->wrapped == (board->rules == RULES_WRAPPED) &&
+        (k->width == board->width && k->height == board->height || !k->width))
+      board->kernel = k;
+
+  pthread_once(&zobrist_once, zobrist_init);
+  board->hash = zobrist_hash(board);
+}
+
+int think(char *res, size_t size, char *req, struct limits limits,
+          struct stats *stats) {
+  // same as `move()`, within `limits`. if `stats` isn't NULL, fill it in
+
+  clock_t start = limits.arrival ? limits.arrival : wall_clock();
+  struct stats local;
+  if (stats == NULL)
+    stats = &local;
+
+  char *moves[] = {"left", "right", "down", "up"}; // JSON escaped
+
+  struct board board = {0};
+  struct meta meta;
+  unsigned int seed = 0;       // for rand_r()
+  unsigned char prev_move = 4; // 4 is an invalid move
+  if (parse(&board, &meta, &seed, &prev_move, req) < 0)
+    return -1;
+
+  prepare(&board);
+
+  // games can be set up with a timeout other than TOTAL_TIME, in which case
+  // keep the same proportion of it for the round trip
+  if (limits.scale && meta.timeout >= 1 && meta.timeout <= 60000) {
+    clock_t total_time = CLOCKS_PER_SEC * meta.timeout / 1000;
+    limits.search_time = total_time * limits.search_time / limits.total_time;
+    limits.total_time = total_time;
   }
 
   // fprintf(stderr, "%s\n", req);
 
+  // several requests may be served concurrently, so buffer the log and write
+  // it out in one go at the end to keep the tables from interleaving
+  char *log_buf;
+  size_t log_size;
+  FILE *log = open_memstream(&log_buf, &log_size);
+  if (log == NULL)
+    return perror("open_memstream"), -1;
+
   time_t t = time(NULL);
-  struct tm *tm = localtime(&t);
+  struct tm tm;
   char buf[sizeof "1999-12-31T23:59:59+0000"]; // ISO 8601
-  if (strftime(buf, sizeof buf, "%FT%T%z", tm) == 0)
+  if (strftime(buf, sizeof buf, "%FT%T%z", localtime_r(&t, &tm)) == 0)
     abort();
-  fprintf(stderr, "\n%s\n", buf);
-
-  short evals[MAX_DEPTH][4] = {0};
-
-  // invariant: commenting this out may give different evals but should never
-  // change what the final `best.move` is
-  srand(seed); // deterministic
-  for (int d = 0; d < MAX_DEPTH; d++)
-    for (unsigned char m = 0; m < 4; m++)
-      evals[d][m] = rand() & USHRT_MAX & ~1;
+  fprintf(log, "\n%s\n", buf);
+
+  // the game id is only used to carry state over between turns, so drop it if
+  // it doesn't fit in a slot
+  char *id = meta.id;
+  size_t id_len = meta.id_end - meta.id;
+  if (id && id_len >= sizeof games->id)
+    id = NULL;
+
+  // with a single legal move there's nothing to search for, so reply right away
+  int n_legal = 0;
+  unsigned char forced = 4;
+  for (unsigned char m = 0; m < 4; m++)
+    if (legal(&board, m))
+      n_legal++, forced = m;
+  if (n_legal == 1) {
+    fprintf(log, "\nFORCED\t%s\n", moves[forced]);
+    fclose(log);
+    if (!limits.quiet)
+      fputs(log_buf, stderr);
+    free(log_buf);
+    *stats = (struct stats){.depth = -1, .move = forced, .forced = true};
+    if (id && !limits.cold)
+      game_forget(id, id_len);
+    telemetry(&meta, &board, stats, start, &limits);
+    return snprintf(res, size, "{\"move\":\"%s\"}\n", moves[forced]);
+  }
 
-  unsigned char move = 0;
-  short root_evals[4] = {0};
+  // the opening book was searched deeper than we could search now, so if it
+  // has the position, reply right away and leave the cores to other games
+  struct book_entry *entry;
+  unsigned char booked = 4;
+  if (limits.book && (entry = book_probe(&board, &booked)) &&
+      legal(&board, booked)) {
+    fprintf(log, "\nBOOK\tDEPTH\tEVAL\n%s\t%d\t%+hd\n", moves[booked],
+            entry->depth, entry->eval);
+    fclose(log);
+    if (!limits.quiet)
+      fputs(log_buf, stderr);
+    free(log_buf);
+    *stats = (struct stats){.depth = -1, .move = booked, .booked = true};
+    if (id && !limits.cold)
+      game_forget(id, id_len);
+    telemetry(&meta, &board, stats, start, &limits);
+    return snprintf(res, size, "{\"move\":\"%s\"}\n", moves[booked]);
+  }
 
   // iterative deepening: iteratively search deeper and deeper until we hit
   // `SEARCH_TIME`, caching move evals as we go along so we can prune more
@@ -531,49 +3264,249 @@ int main(void) {
   // mind that with alpha--beta pruning, cached evals are lower/upper bounds
   // on the real evals, so they can't be used to deduce the final `best.move`
 
-  clock_t start = clock(), prev = start;
-  fprintf(stderr, "\nDEPTH\tMICROS\tTOTAL\tEVALS\tEVALS/S\n");
-  for (int depth = 0; depth <= MAX_DEPTH; depth++) {
-    jmp_buf abort;
-    if (setjmp(abort) != 0)
-      break;
+  if (limits.schedule)
+    sched_admit(&limits);
+  struct search searches[THREADS];
+  struct shared shared = {.depth = -1, .warm = -1, .prev_move = prev_move,
+                          .only = 4, .board = board, .log = log,
+                          .searches = searches, .threads = limits.threads,
+                          .limits = limits};
+  if ((errno = pthread_mutex_init(&shared.mutex, NULL))) {
+    if (limits.schedule)
+      sched_release(&limits);
+    return perror("pthread_mutex_init"), fclose(log), free(log_buf), -1;
+  }
 
-    // if the game engine doesn't receive our move within `TOTAL_TIME`, we time
-    // out and the move we made on the previous turn is repeated. so when the
-    // current `best.move` happens to be the same as our previous move, timing
-    // out is okay and we can keep on searching past `SEARCH_TIME`. credit to
-    // John Scales for the idea
-    clock_t cutoff = move == prev_move ? start + CLOCKS_PER_SEC * TOTAL_TIME
-                                       : start + CLOCKS_PER_SEC * SEARCH_TIME;
-    move = turn(cutoff, abort, &board, evals, EVAL_MIN, EVAL_MAX, depth).move;
-    memcpy(root_evals, evals, sizeof root_evals);
+  for (int t = 0; t < THREADS; t++) {
+    searches[t] = (struct search){.shared = &shared};
+    memset(searches[t].killers, 4, sizeof searches[t].killers); // invalid move
+    unsigned int t_seed = seed + t;
+    // invariant: commenting this out may give different evals but should
+    // never change what the final `best.move` is
+    for (int d = 0; d < MAX_DEPTH; d++) // deterministic
+      for (unsigned char m = 0; m < 4; m++)
+        searches[t].evals[d][m] = rand_r(&t_seed) & USHRT_MAX & ~1;
+  }
+
+  // carry state over from the previous turn, if it was searched by this same
+  // process. cached evals are per ply, so shift them by a turn's worth of
+  // plies. the previous search already solved the shallow depths and the
+  // transposition table still holds its results, so warm-start a turn's worth
+  // of plies short of where it left off. the depths skipped over don't count
+  // as completed, so should that iteration not complete in time, no depth is
+  // reported and we fall back to the move the previous search expected us to
+  // make on this turn
+  int plies = 0;
+  for (int s = 0; s < MAX_SNAKES; s++)
+    plies += !!board.snakes[s].health;
+
+  *stats = (struct stats){0};
+  struct game game = {.turn = -1};
+  struct ponder *pondered = NULL;
+  if (id && !limits.cold) {
+    pthread_mutex_lock(&games_mutex);
+    struct game *slot = game_find(id, id_len, true);
+    game = *slot, pondered = slot->ponder, slot->ponder = NULL;
+    pthread_mutex_unlock(&games_mutex);
+  }
+
+  // if the previous turn was pondered and this is the position it expected,
+  // carry over the pondered search rather than the one we replied with
+  if (pondered) {
+    ponder_stop(pondered);
+    stats->pondered = true;
+    stats->hit = game.turn >= 0 && game.turn + 1 == meta.turn &&
+                 ponder_hit(pondered, &board);
+    int pondered_depth = pondered->shared.depth;
+    stats->gained =
+        pondered_depth >= 0 ? pondered_depth - pondered->shared.warm : 0;
+    if (stats->hit && pondered_depth >= 0) {
+      game.depth = pondered_depth;
+      memcpy(game.pv, pondered->shared.pv,
+             game.pv_len = pondered->shared.pv_len);
+    }
+    if (stats->hit)
+      for (int t = 0; t < THREADS; t++)
+        memcpy(game.evals[t], pondered->searches[t].evals,
+               sizeof game.evals[t]);
+    fprintf(log, "\nPONDER\tGAINED\n%s\t%d\n", stats->hit ? "HIT" : "MISS",
+            stats->gained);
+    free(pondered);
+  }
+
+  // should the first iteration abort before any root move completes, which a
+  // deep warm start makes likely, `shared.move` is the reply, so it must at
+  // least be legal. `forced` is the last legal move found above
+  shared.move = forced;
+  if (game.turn >= 0 && game.turn + 1 == meta.turn) {
+    for (int t = 0; t < THREADS; t++)
+      for (int d = 0; d + game.plies < MAX_DEPTH; d++)
+        memcpy(searches[t].evals[d], game.evals[t][d + game.plies],
+               sizeof *game.evals[t]);
+    // the cached root evals say which legal move looked best last turn, and
+    // the principal variation says which one the previous search expected
+    for (unsigned char m = 0; m < 4; m++)
+      if (legal(&board, m) &&
+          searches->evals[0][m] > searches->evals[0][shared.move])
+        shared.move = m;
+    // a miss means we're off the principal variation, whose depth we'd be
+    // warm-starting from
+    if (game.depth - game.plies > 0 && !(stats->pondered && !stats->hit))
+      shared.warm = game.depth - game.plies - 1;
+    if (game.pv_len > game.plies && game.pv[game.plies] < 4 &&
+        legal(&board, game.pv[game.plies]))
+      shared.move = game.pv[game.plies];
+    fprintf(log, "\nWARM\t%d\n", shared.warm + 1);
+  }
 
-    clock_t now = clock();
-    fprintf(stderr, "%d\t%06lld\t%06lld\t%7d\t%7lld\n", depth,
-            (long long)(now - prev) * 1000000 / CLOCKS_PER_SEC,
-            (long long)(now - start) * 1000000 / CLOCKS_PER_SEC, n_evals,
-            (long long)n_evals * CLOCKS_PER_SEC / (now - start));
-    prev = now;
+  atomic_fetch_add(&tt_generation, 1);
+  shared.start = shared.prev = start;
+  fprintf(log, "\nKERNEL\t%s\n", board.kernel->name);
+  fprintf(log, "\nDEPTH\tMICROS\tTOTAL\tEVALS\tEVALS/S\tHIGHS\tLOWS\tRESRCH\n");
+  int threads = run(searches, limits.threads);
+  if (limits.schedule)
+    sched_release(&limits);
+  pthread_mutex_destroy(&shared.mutex);
+
+  unsigned char move = shared.move;
+  short *root_evals = shared.root_evals;
+
+  if (id && !limits.cold) {
+    pthread_mutex_lock(&games_mutex);
+    // the game may have ended while we were searching
+    struct game *game = game_find(id, id_len, false);
+    if (game) {
+      game->turn = meta.turn, game->plies = plies, game->depth = shared.depth;
+      memcpy(game->pv, shared.pv, game->pv_len = shared.pv_len);
+      for (int t = 0; t < THREADS; t++)
+        memcpy(game->evals[t], searches[t].evals, sizeof game->evals[t]);
+      // a duplicate request may have started pondering already
+      if (limits.ponder && !game->ponder)
+        game->ponder = ponder_start(&shared, searches);
+    }
+    pthread_mutex_unlock(&games_mutex);
   }
 
-  clock_t now = clock();
-  fprintf(stderr, "ABORT\t%06lld\t%06lld\t%7d\t%7lld\n",
-          (long long)(now - prev) * 1000000 / CLOCKS_PER_SEC,
-          (long long)(now - start) * 1000000 / CLOCKS_PER_SEC, n_evals,
-          (long long)n_evals * CLOCKS_PER_SEC / (now - start));
+  clock_t now = wall_clock();
+  int n_evals = 0, n_highs = 0, n_lows = 0, n_researches = 0;
+  for (int t = 0; t < threads; t++)
+    n_evals += searches[t].n_evals, n_highs += searches[t].n_highs,
+        n_lows += searches[t].n_lows,
+        n_researches += searches[t].n_researches;
+  fprintf(log, "ABORT\t%06lld\t%06lld\t%7d\t%7lld\t%d\t%d\t%d\n",
+          (long long)(now - shared.prev) * 1000000 / CLOCKS_PER_SEC,
+          (long long)(now - shared.start) * 1000000 / CLOCKS_PER_SEC, n_evals,
+          (long long)n_evals * CLOCKS_PER_SEC / (now - shared.start), n_highs,
+          n_lows, n_researches);
+
+  int n_probes = 0, n_hits = 0, n_cutoffs = 0, n_regions = 0, n_settled = 0;
+  int n_reduced = 0;
+  for (int t = 0; t < threads; t++)
+    n_probes += searches[t].n_probes, n_hits += searches[t].n_hits,
+        n_cutoffs += searches[t].n_cutoffs,
+        n_regions += searches[t].n_regions, n_settled += searches[t].n_settled,
+        n_reduced += searches[t].n_reduced;
+  if (shared.predicted)
+    fprintf(log, "PREDICT\t%06lld\n",
+            (long long)(shared.predicted - shared.start) * 1000000 /
+                CLOCKS_PER_SEC);
+  if (shared.partial_depth)
+    fprintf(log, "PARTIAL\t%d\n", shared.partial_depth);
+
+  fprintf(log, "\nPROBES\tHITS\tCUTOFFS\n%d\t%d\t%d\n", n_probes, n_hits,
+          n_cutoffs);
+  fprintf(log, "\nREGIONS\tSETTLED\n%d\t%d\n", n_regions, n_settled);
+  fprintf(log, "\nREDUCED\n%d\n", n_reduced);
+
+  // how good move ordering is: the fraction of beta cutoffs caused by the first
+  // move searched and the average number of moves searched per node
+  int n_betas = 0, n_firsts = 0, n_children = 0, n_nodes = 0;
+  for (int t = 0; t < threads; t++)
+    n_betas += searches[t].n_betas, n_firsts += searches[t].n_firsts,
+        n_children += searches[t].n_children, n_nodes += searches[t].n_nodes;
+  fprintf(log, "\nBETAS\tFIRST\tCHILDREN\n%d\t%.3f\t%.3f\n", n_betas,
+          n_betas ? (double)n_firsts / n_betas : 0.0,
+          n_nodes ? (double)n_children / n_nodes : 0.0);
 
   // invariant: uncommenting this and commenting out iterative deepening may
   // slow down search and give different evals but should never change what
   // the final `best.move` is
-  // move = turn(0, (jmp_buf){0}, &board, evals, EVAL_MIN, EVAL_MAX, 20).move;
-  // memcpy(root_evals, *evals, sizeof root_evals);
-
-  char *moves[] = {"left", "right", "down", "up"}; // JSON escaped
+  // move = turn(searches, &board, searches->evals, EVAL_MIN, EVAL_MAX, 20)
+  //            .move;
+  // memcpy(root_evals, *searches->evals, sizeof *searches->evals);
 
-  fprintf(stderr, "\nMOVE\tEVAL\tBEST\n");
+  fprintf(log, "\nMOVE\tEVAL\tBEST\n");
   for (int m = 0; m < 4; m++)
-    fprintf(stderr, "%s\t%+hd\t%d\n", moves[m], root_evals[m], move == m);
+    fprintf(log, "%s\t%+hd\t%d\n", moves[m], root_evals[m], move == m);
+
+  fprintf(log, "\nPV\t");
+  for (int p = 0; p < shared.pv_len; p++)
+    fputc("LRDU-"[shared.pv[p]], log);
+  fputc('\n', log);
+
+  stats->depth = shared.depth, stats->move = move, stats->betas = n_betas;
+  stats->eval = root_evals[move];
+  stats->threads = threads;
+  for (int d = 0; d <= shared.depth; d++)
+    stats->time[d] = shared.done[d] ? shared.done[d] - shared.start : 0,
+    stats->depth_nodes[d] = shared.done[d] ? shared.nodes[d] : 0;
+  for (int t = 0; t < threads; t++)
+    stats->nodes += searches[t].n_nodes, stats->evals += searches[t].n_evals;
+
+  fclose(log);
+  if (!limits.quiet)
+    fputs(log_buf, stderr);
+  free(log_buf);
+
+  telemetry(&meta, &board, stats, start, &limits);
+  return snprintf(res, size, "{\"move\":\"%s\"}\n", moves[move]);
+}
+
+int move_since(char *res, size_t size, char *req, clock_t arrival) {
+  // handle a `/move` request that arrived at `wall_clock()` time `arrival`.
+  // `req` is the NUL-terminated request body and the JSON response is written
+  // to `res` the same way `snprintf()` would. returns a negative value and logs
+  // why if the request is malformed
+
+  return think(res, size, req,
+               (struct limits){.arrival = arrival,
+                               .depth = MAX_DEPTH,
+                               .search_time = CLOCKS_PER_SEC * SEARCH_TIME,
+                               .total_time = CLOCKS_PER_SEC * TOTAL_TIME,
+                               .scale = true,
+                               .threads = THREADS,
+                               .reduce = REDUCE,
+                               .brs = BRS,
+                               .schedule = scheduling,
+                               .ponder = pondering,
+                               .book = true},
+               NULL);
+}
+
+int move(char *res, size_t size, char *req) {
+  // same as `move_since()`, for a request that just arrived
+  return move_since(res, size, req, wall_clock());
+}
+
+#ifndef NO_MAIN
+int main(void) {
+  clock_t arrival = wall_clock();
+  static char req[1 << 16];
+  size_t size = fread(req, 1, sizeof req - 1, stdin);
+  if (ferror(stdin))
+    perror("fread"), exit(EXIT_FAILURE);
+  if (!feof(stdin))
+    fputs("request buffer exhausted\n", stderr), exit(EXIT_FAILURE);
+  req[size] = '\0';
+
+  telemetering = getenv("SANDWORM_TELEMETRY") != NULL;
+  char res[1 << 10];
+  if (move_since(res, sizeof res, req, arrival) < 0)
+    exit(EXIT_FAILURE);
 
   printf("Status: 200 OK\nContent-Type: application/json\n\n");
-  printf("{\"move\":\"%s\"}\n", moves[move]);
+  fputs(res, stdout);
+  fflush(stdout);
+  telemetry_flush();
 }
+#endif
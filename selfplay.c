@@ -0,0 +1,481 @@
+// move.c is included rather than linked, for its JSON parser and wall clock
+#define _GNU_SOURCE // for `pipe2()`
+#define NO_MAIN
+#include "move.c"
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// a headless game engine that plays two builds of Sandworm against each other
+// and reports how often the first one wins. engines are `bin/move` binaries
+// spoken to the same way lighttpd does through cgi.conf: one process per move,
+// with the request on `stdin` and the response on `stdout`. every engine plays
+// with its own timeout, passed along in the request, and replies that come in
+// late are dropped in favor of the previous move, as the game engine does.
+// that way `bin/selfplay bin/move:100 old/move:400` tells whether a faster
+// search given a quarter of the time plays as well as the old one
+//
+// the rules are those of the standard ruleset: simultaneous moves, starvation,
+// food that makes snakes grow on the following turn, head-to-head collisions
+// that the longer snake survives, and food spawning. games are played in pairs
+// from the same seed with the engines swapping seats, to cancel out the luck
+// of the draw
+
+// a larger GAMES narrows the confidence interval, which shrinks with the
+// square root of the number of games. a larger JOBS plays more games at once,
+// but every engine runs THREADS threads and engines time out once they run out
+// of cores, so keep it under the number of cores divided by `THREADS * snakes`
+#define GAMES 100      // default number of games to play
+#define JOBS 1         // default number of games to play concurrently
+#define SNAKES 2       // default number of snakes per game
+#define SIZE 11        // default width and height of the board
+#define MAX_TURNS 1000 // turn after which a game is called a draw
+#define MIN_FOOD 1     // minimum amount of food on the board
+#define FOOD_CHANCE 15 // chance to spawn food every turn, in percent
+#define MAX_CELLS 1024 // max number of cells, for allocating buffers
+#define MAX_PLAYERS 8  // max number of snakes, for allocating buffers
+
+struct point {
+  int x, y;
+};
+
+struct engine {
+  char *path;
+  int timeout; // in millis
+  // stats over the whole run, protected by `mutex`
+  long long moves, micros;
+  int timeouts;
+};
+
+struct player {
+  struct engine *engine;
+  struct point body[MAX_CELLS + 2]; // from head to tail
+  int length, health;
+  bool alive;
+  unsigned char move; // last move made, repeated on timeout
+};
+
+struct arena {
+  int width, height, turn;
+  struct player players[MAX_PLAYERS];
+  int n_players;
+  struct point food[MAX_CELLS];
+  int n_food;
+  unsigned int seed; // for rand_r()
+};
+
+struct engine engines[2];
+int n_games = GAMES, n_snakes = SNAKES, width = SIZE, height = SIZE;
+atomic_int next_game;
+int scores[3]; // games won by either engine and games drawn
+double sum_sq; // sum of squared scores of the first engine, for the variance
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+bool occupied(struct arena *arena, struct point p) {
+  // whether a point holds food or the body of a live snake
+  for (int f = 0; f < arena->n_food; f++)
+    if (arena->food[f].x == p.x && arena->food[f].y == p.y)
+      return true;
+  for (int s = 0; s < arena->n_players; s++) {
+    struct player *player = arena->players + s;
+    for (int b = 0; player->alive && b < player->length; b++)
+      if (player->body[b].x == p.x && player->body[b].y == p.y)
+        return true;
+  }
+  return false;
+}
+
+void spawn_food(struct arena *arena, int n) {
+  // place `n` food on random free cells, as many as there's room for
+  struct point free[MAX_CELLS];
+  int n_free = 0;
+  for (int y = 0; y < arena->height; y++)
+    for (int x = 0; x < arena->width; x++)
+      if (!occupied(arena, (struct point){x, y}))
+        free[n_free++] = (struct point){x, y};
+  for (; n > 0 && n_free > 0; n--) {
+    int i = rand_r(&arena->seed) % n_free;
+    arena->food[arena->n_food++] = free[i], free[i] = free[--n_free];
+  }
+}
+
+void setup(struct arena *arena) {
+  // place the snakes and the initial food the way the standard ruleset does:
+  // snakes start coiled up on fixed points, with one food diagonal to each of
+  // them, away from the center, and one food in the center
+  int lo = 1, mid = (arena->width - 1) / 2, hi = arena->width - 2;
+  int mid_y = (arena->height - 1) / 2, hi_y = arena->height - 2;
+  struct point corners[] = {{lo, lo}, {lo, hi_y}, {hi, lo}, {hi, hi_y}};
+  struct point sides[] = {{lo, mid_y}, {mid, lo}, {mid, hi_y}, {hi, mid_y}};
+  for (int i = 3; i > 0; i--) {
+    int j = rand_r(&arena->seed) % (i + 1), k = rand_r(&arena->seed) % (i + 1);
+    struct point c = corners[i], s = sides[i];
+    corners[i] = corners[j], corners[j] = c;
+    sides[i] = sides[k], sides[k] = s;
+  }
+  bool corners_first = rand_r(&arena->seed) % 2;
+  for (int p = 0; p < arena->n_players; p++) {
+    struct player *player = arena->players + p;
+    struct point start = (p < 4) == corners_first ? corners[p % 4]
+                                                  : sides[p % 4];
+    player->length = 3, player->health = 100, player->alive = true;
+    player->move = 3; // up, by convention
+    for (int b = 0; b < player->length; b++)
+      player->body[b] = start;
+  }
+
+  struct point center = {mid, mid_y};
+  for (int p = 0; p < arena->n_players; p++) {
+    struct point head = *arena->players[p].body, options[4];
+    int n_options = 0;
+    for (int d = 0; d < 4; d++) {
+      struct point f = {head.x + (d & 1 ? 1 : -1), head.y + (d & 2 ? 1 : -1)};
+      bool away = f.x < head.x && head.x < center.x ||
+                  center.x < head.x && head.x < f.x ||
+                  f.y < head.y && head.y < center.y ||
+                  center.y < head.y && head.y < f.y;
+      bool corner = (f.x == 0 || f.x == arena->width - 1) &&
+                    (f.y == 0 || f.y == arena->height - 1);
+      if (f.x >= 0 && f.x < arena->width && f.y >= 0 && f.y < arena->height &&
+          away && !corner && !occupied(arena, f))
+        options[n_options++] = f;
+    }
+    if (n_options)
+      arena->food[arena->n_food++] = options[rand_r(&arena->seed) % n_options];
+  }
+  if (!occupied(arena, center))
+    arena->food[arena->n_food++] = center;
+}
+
+int request(char *buf, size_t size, struct arena *arena, int index, int you) {
+  // write the `/move` request for player `you`. see example-move.json
+  int len = snprintf(buf, size,
+                     "{\"game\":{\"id\":\"selfplay-%d\",\"ruleset\":{\"name\":"
+                     "\"standard\"},\"timeout\":%d},\"turn\":%d,\"board\":{"
+                     "\"height\":%d,\"width\":%d,\"food\":[",
+                     index, arena->players[you].engine->timeout, arena->turn,
+                     arena->height, arena->width);
+  for (int f = 0; f < arena->n_food; f++)
+    len += snprintf(buf + len, size - len, &",{\"x\":%d,\"y\":%d}"[!f],
+                    arena->food[f].x, arena->food[f].y);
+  len += snprintf(buf + len, size - len, "],\"hazards\":[],\"snakes\":[");
+
+  // the snakes, then ourselves once more as `you`
+  for (int p = 0, n = 0; p <= arena->n_players; p++) {
+    struct player *player = arena->players + (p < arena->n_players ? p : you);
+    if (!player->alive)
+      continue;
+    if (p == arena->n_players)
+      len += snprintf(buf + len, size - len, "]},\"you\":");
+    else if (n++)
+      len += snprintf(buf + len, size - len, ",");
+    len += snprintf(buf + len, size - len,
+                    "{\"id\":\"snake-%d\",\"health\":%d,\"length\":%d,"
+                    "\"head\":{\"x\":%d,\"y\":%d},\"body\":[",
+                    (int)(player - arena->players), player->health,
+                    player->length, player->body->x, player->body->y);
+    for (int b = 0; b < player->length; b++)
+      len += snprintf(buf + len, size - len, &",{\"x\":%d,\"y\":%d}"[!b],
+                      player->body[b].x, player->body[b].y);
+    len += snprintf(buf + len, size - len, "]}");
+  }
+  len += snprintf(buf + len, size - len, "}\n");
+  return len < size ? len : -1;
+}
+
+struct call {
+  pid_t pid;
+  int fd; // engine's `stdout`
+  char res[1 << 10];
+  size_t len;
+  clock_t start, end;
+};
+
+void call(struct call *call, char *path, char *req, size_t len) {
+  // run an engine on a request without waiting for it to reply. pipes are
+  // close-on-exec so that the engines of concurrent games don't inherit each
+  // other's pipes and wait on an end-of-file that never comes
+  int in[2], out[2];
+  if (pipe2(in, O_CLOEXEC) == -1 || pipe2(out, O_CLOEXEC) == -1)
+    perror("pipe2"), exit(EXIT_FAILURE);
+  *call = (struct call){.fd = out[0], .start = wall_clock()};
+  if ((call->pid = fork()) == -1)
+    perror("fork"), exit(EXIT_FAILURE);
+  if (call->pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(in[0], STDIN_FILENO), dup2(out[1], STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    execl(path, path, (char *)NULL);
+    _exit(127);
+  }
+  close(in[0]), close(out[1]);
+  for (size_t n = 0; n < len;) {
+    ssize_t w = write(in[1], req + n, len - n);
+    if (w == -1 && errno == EINTR)
+      continue;
+    if (w == -1)
+      break; // the engine died, which `collect()` will find out
+    n += w;
+  }
+  close(in[1]);
+}
+
+void collect(struct call *calls, int n) {
+  // wait for the engines to reply, noting when each one did. engines that
+  // take ten times longer than the game engine would wait for are killed
+  clock_t deadline = wall_clock() + CLOCKS_PER_SEC * 10;
+  for (int pending = n; pending;) {
+    struct pollfd fds[MAX_PLAYERS];
+    for (int c = 0; c < n; c++)
+      fds[c] = (struct pollfd){.fd = calls[c].fd, .events = POLLIN};
+    int millis = (deadline - wall_clock()) * 1000 / CLOCKS_PER_SEC;
+    if (millis <= 0 || poll(fds, n, millis) == 0) {
+      for (int c = 0; c < n; c++)
+        if (calls[c].fd != -1)
+          kill(calls[c].pid, SIGKILL);
+      break;
+    }
+    for (int c = 0; c < n; c++) {
+      if (calls[c].fd == -1 || !fds[c].revents)
+        continue;
+      struct call *call = calls + c;
+      ssize_t r = read(call->fd, call->res + call->len,
+                       sizeof call->res - 1 - call->len);
+      if (r == -1 && errno == EINTR)
+        continue;
+      if (r > 0 && (call->len += r) < sizeof call->res - 1)
+        continue;
+      call->res[call->len] = '\0', call->end = wall_clock();
+      close(call->fd), call->fd = -1, pending--;
+    }
+  }
+  for (int c = 0; c < n; c++) {
+    if (calls[c].fd != -1)
+      close(calls[c].fd), calls[c].end = wall_clock();
+    waitpid(calls[c].pid, NULL, 0);
+  }
+}
+
+unsigned char reply(struct call *call) {
+  // the move in an engine's reply, or 4 if there's none. the reply starts with
+  // CGI headers, so look for the JSON object past them
+  char *moves[] = {"left", "right", "down", "up"};
+  char *json = strstr(call->res, "\n\n");
+  char *move = jsonw_lookup("move", jsonw_beginobj(json ? json + 2 : NULL));
+  for (unsigned char m = 0; m < 4; m++)
+    if (move && jsonw_strcmp(moves[m], jsonw_beginstr(move)) == 0)
+      return m;
+  return 4;
+}
+
+void advance(struct arena *arena, unsigned char *moves) {
+  // play one turn of the standard ruleset, given every live snake's move
+  struct player *players = arena->players, *end = players + arena->n_players;
+
+  // move: every head moves and every tail follows
+  for (struct player *p = players; p < end; p++) {
+    if (!p->alive)
+      continue;
+    memmove(p->body + 1, p->body, (p->length - 1) * sizeof *p->body);
+    p->body->x += moves[p - players] == 0 ? -1 : moves[p - players] == 1;
+    p->body->y += moves[p - players] == 2 ? -1 : moves[p - players] == 3;
+    p->health--;
+  }
+
+  // feed: eating resets health and grows the tail on the following turn
+  bool eaten[MAX_CELLS] = {0};
+  for (struct player *p = players; p < end; p++)
+    for (int f = 0; p->alive && f < arena->n_food; f++)
+      if (p->body->x == arena->food[f].x && p->body->y == arena->food[f].y) {
+        p->health = 100, eaten[f] = true;
+        p->body[p->length] = p->body[p->length - 1], p->length++;
+      }
+  for (int f = arena->n_food; f--;)
+    if (eaten[f])
+      arena->food[f] = arena->food[--arena->n_food];
+
+  // eliminate: starvation and walls first, then collisions with whoever is
+  // left, all at once
+  for (struct player *p = players; p < end; p++)
+    p->alive &= p->health > 0 && p->body->x >= 0 &&
+                p->body->x < arena->width && p->body->y >= 0 &&
+                p->body->y < arena->height;
+  bool dead[MAX_PLAYERS] = {0};
+  for (struct player *p = players; p < end; p++)
+    for (struct player *q = players; p->alive && q < end; q++) {
+      if (!q->alive)
+        continue;
+      for (int b = 1; b < q->length; b++)
+        dead[p - players] |=
+            p->body->x == q->body[b].x && p->body->y == q->body[b].y;
+      dead[p - players] |= p != q && p->body->x == q->body->x &&
+                           p->body->y == q->body->y && p->length <= q->length;
+    }
+  for (struct player *p = players; p < end; p++)
+    p->alive &= !dead[p - players];
+
+  if (arena->n_food < MIN_FOOD)
+    spawn_food(arena, MIN_FOOD - arena->n_food);
+  else if (rand_r(&arena->seed) % 100 < FOOD_CHANCE)
+    spawn_food(arena, 1);
+  arena->turn++;
+}
+
+int play(int index, int *turns) {
+  // play a game. returns which engine won, or 2 for a draw
+  struct arena *arena = calloc(1, sizeof *arena);
+  if (arena == NULL)
+    perror("calloc"), exit(EXIT_FAILURE);
+  arena->width = width, arena->height = height, arena->n_players = n_snakes;
+  arena->seed = index / 2; // games come in pairs, with engines swapping seats
+  for (int p = 0; p < n_snakes; p++)
+    arena->players[p].engine = engines + (p + index) % 2;
+  setup(arena);
+
+  int alive = n_snakes;
+  while (alive > (n_snakes > 1) && arena->turn < MAX_TURNS) {
+    static _Thread_local char req[1 << 16];
+    struct call calls[MAX_PLAYERS];
+    int who[MAX_PLAYERS], n = 0;
+    for (int p = 0; p < n_snakes; p++) {
+      if (!arena->players[p].alive)
+        continue;
+      int len = request(req, sizeof req, arena, index, p);
+      if (len < 0)
+        fputs("request buffer exhausted\n", stderr), exit(EXIT_FAILURE);
+      call(calls + n, arena->players[p].engine->path, req, len);
+      who[n++] = p;
+    }
+    collect(calls, n);
+
+    // late or missing replies repeat the previous move
+    unsigned char moves[MAX_PLAYERS];
+    for (int c = 0; c < n; c++) {
+      struct player *player = arena->players + who[c];
+      struct engine *engine = player->engine;
+      clock_t time = calls[c].end - calls[c].start;
+      unsigned char move = reply(calls + c);
+      bool late = move == 4 || time > CLOCKS_PER_SEC * engine->timeout / 1000;
+      moves[who[c]] = player->move = late ? player->move : move;
+      pthread_mutex_lock(&mutex);
+      engine->moves++, engine->timeouts += late;
+      engine->micros += (long long)time * 1000000 / CLOCKS_PER_SEC;
+      pthread_mutex_unlock(&mutex);
+    }
+    advance(arena, moves);
+
+    alive = 0;
+    for (int p = 0; p < n_snakes; p++)
+      alive += arena->players[p].alive;
+  }
+
+  int winner = 2;
+  for (int p = 0; p < n_snakes; p++)
+    if (alive == 1 && arena->players[p].alive)
+      winner = arena->players[p].engine - engines;
+  *turns = arena->turn;
+  free(arena);
+  return winner;
+}
+
+double elo(double score) {
+  // Elo difference that corresponds to a score, which is finite even for
+  // scores of 0 and 1 so that short runs still print something readable
+  score = fmin(fmax(score, 1e-3), 1 - 1e-3);
+  return 400 * log10(score / (1 - score));
+}
+
+void *work(void *arg) {
+  // play games until there are none left to play
+  (void)arg;
+  for (int g; (g = atomic_fetch_add(&next_game, 1)) < n_games;) {
+    int turns, winner = play(g, &turns);
+    double score = winner == 0 ? 1 : winner == 2 ? 0.5 : 0;
+    pthread_mutex_lock(&mutex);
+    scores[winner]++, sum_sq += score * score;
+    if (winner == 2)
+      printf("%d\t%d\tdraw\n", g, turns);
+    else
+      printf("%d\t%d\t%s:%d\n", g, turns, engines[winner].path,
+             engines[winner].timeout);
+    fflush(stdout);
+    pthread_mutex_unlock(&mutex);
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  int jobs = JOBS;
+  for (int opt; (opt = getopt(argc, argv, "g:j:s:w:h:")) != -1;)
+    switch (opt) {
+    case 'g':
+      n_games = atoi(optarg);
+      break;
+    case 'j':
+      jobs = atoi(optarg);
+      break;
+    case 's':
+      n_snakes = atoi(optarg);
+      break;
+    case 'w':
+      width = atoi(optarg);
+      break;
+    case 'h':
+      height = atoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  if (argc - optind != 2) {
+  usage:
+    fprintf(stderr,
+            "usage: %s [-g games] [-j jobs] [-s snakes] [-w width] "
+            "[-h height] engine[:millis] engine[:millis]\n",
+            *argv);
+    exit(EXIT_FAILURE);
+  }
+  if (n_games < 1 || jobs < 1 || n_snakes < 1 || n_snakes > MAX_PLAYERS ||
+      width < 3 || height < 3 || width * height > MAX_CELLS)
+    fputs("bad games, jobs, snakes or board size\n", stderr),
+        exit(EXIT_FAILURE);
+
+  // `path:millis` plays with a timeout of `millis` instead of TOTAL_TIME
+  for (int e = 0; e < 2; e++) {
+    char *path = argv[optind + e], *colon = strrchr(path, ':');
+    engines[e] = (struct engine){.path = path, .timeout = 1000 * TOTAL_TIME};
+    if (colon && colon[1] && strspn(colon + 1, "0123456789") ==
+                                 strlen(colon + 1))
+      *colon = '\0', engines[e].timeout = atoi(colon + 1);
+    if (engines[e].timeout < 1 || access(path, X_OK) == -1)
+      perror(path), exit(EXIT_FAILURE);
+  }
+
+  printf("GAME\tTURNS\tWINNER\n");
+  pthread_t threads[jobs];
+  for (int j = 0; j < jobs; j++)
+    if ((errno = pthread_create(threads + j, NULL, work, NULL)))
+      perror("pthread_create"), exit(EXIT_FAILURE);
+  for (int j = 0; j < jobs; j++)
+    pthread_join(threads[j], NULL);
+
+  // score of the first engine, counting draws as half a win, with a 95%
+  // confidence interval from the normal approximation. the Elo difference is
+  // derived from the score, and so is its interval
+  double score = (scores[0] + scores[2] * 0.5) / n_games;
+  double stddev = sqrt(fmax(sum_sq / n_games - score * score, 0));
+  double margin = 1.96 * stddev / sqrt(n_games);
+
+  printf("\nENGINE\tTIMEOUT\tWINS\tLOSSES\tDRAWS\tMOVES\tMS/MOVE\tLATE\n");
+  for (int e = 0; e < 2; e++)
+    printf("%s\t%d\t%d\t%d\t%d\t%lld\t%.1f\t%d\n", engines[e].path,
+           engines[e].timeout, scores[e], scores[!e], scores[2],
+           engines[e].moves,
+           engines[e].moves ? engines[e].micros / 1000.0 / engines[e].moves
+                            : 0,
+           engines[e].timeouts);
+  printf("\nSCORE\t95%%\tELO\t95%%\n%.3f\t%.3f\t%+.0f\t%+.0f..%+.0f\n", score,
+         margin, elo(score), elo(score - margin), elo(score + margin));
+}
@@ -0,0 +1,263 @@
+#define _POSIX_C_SOURCE 200809L // for `strncasecmp()` and sockets
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// a long-running HTTP/1.1 server that serves every endpoint from a single
+// process, as an alternative to cgi.conf. going through CGI means a fork() and
+// an exec() per request plus cold caches for every search, which eats into
+// `SEARCH_TIME` and makes latency jittery. here, every worker thread serves one
+// keep-alive connection at a time out of buffers allocated once at startup
+
+// a larger WORKERS allows more concurrent connections but each one may end up
+// running a search, so it should stay around the number of concurrent games. a
+// smaller KEEPALIVE frees up workers held by idle connections sooner
+#define PORT 9090    // default port to listen on, same as cgi.conf
+#define WORKERS 16   // number of connections that can be served concurrently
+#define KEEPALIVE 60 // seconds after which to close an idle connection
+
+// request handlers, from index.c and move.c
+int info(char *res, size_t size, char *req);
+int start(char *res, size_t size, char *req);
+int end(char *res, size_t size, char *req);
+int move(char *res, size_t size, char *req);
+int move_since(char *res, size_t size, char *req, clock_t arrival);
+clock_t wall_clock(void);
+void telemetry_flush(void);
+void telemetry_dump(FILE *file);
+extern bool pondering, scheduling, telemetering;
+
+struct route {
+  char *path;
+  int (*handler)(char *res, size_t size, char *req);
+} routes[] = {{"/", info}, {"/start", start}, {"/end", end}, {"/move", move}};
+
+struct worker {
+  pthread_t thread;
+  // `req` holds the bytes read from the connection so far, possibly several
+  // pipelined requests. `res` holds the body of the response being sent
+  char req[1 << 16], res[1 << 10];
+};
+
+int sock; // listening socket, shared by all workers
+
+bool respond(int fd, char *status, char *body, size_t len, bool keep_alive) {
+  char head[256];
+  int head_len = snprintf(head, sizeof head,
+                          "HTTP/1.1 %s\r\n"
+                          "Content-Type: application/json\r\n"
+                          "Content-Length: %zu\r\n"
+                          "Connection: %s\r\n\r\n",
+                          status, len, keep_alive ? "keep-alive" : "close");
+
+  // send the head and the body in one go, because of `TCP_NODELAY`
+  struct iovec iov[2] = {{.iov_base = head, .iov_len = head_len},
+                         {.iov_base = body, .iov_len = len}};
+  for (int i = 0; i < 2;) {
+    ssize_t n = writev(fd, iov + i, 2 - i);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+      return false;
+    for (; i < 2 && (size_t)n >= iov[i].iov_len; i++)
+      n -= iov[i].iov_len;
+    if (i < 2)
+      iov[i].iov_base = (char *)iov[i].iov_base + n, iov[i].iov_len -= n;
+  }
+
+  return keep_alive;
+}
+
+void serve(struct worker *worker, int fd) {
+  // serve requests on `fd` until the client closes the connection, asks us to
+  // close it or sends something we can't make sense of
+
+  size_t len = 0; // number of bytes in `worker->req`
+  worker->req[len] = '\0';
+
+  for (;;) {
+    // read until we have the entire head of the request. the move's time
+    // budget counts from when its first byte came in, not from when we're
+    // done reading it
+    char *body;
+    clock_t arrival = len ? wall_clock() : 0;
+    while ((body = strstr(worker->req, "\r\n\r\n")) == NULL) {
+      if (len == sizeof worker->req - 1) {
+        respond(fd, "431 Request Header Fields Too Large", "", 0, false);
+        return;
+      }
+      ssize_t n = read(fd, worker->req + len, sizeof worker->req - 1 - len);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return; // closed, timed out or errored
+      len += n, worker->req[len] = '\0';
+      if (!arrival)
+        arrival = wall_clock();
+    }
+    body += sizeof "\r\n\r\n" - 1;
+
+    // request line, e.g. 'POST /move HTTP/1.1'. the method doesn't matter
+    char *path = strchr(worker->req, ' '), *version;
+    if (path == NULL || (version = strchr(++path, ' ')) == NULL) {
+      respond(fd, "400 Bad Request", "", 0, false);
+      return;
+    }
+    size_t path_len = strcspn(path, " ?");
+    bool keep_alive = strncmp(version, " HTTP/1.1\r\n", 11) == 0;
+
+    size_t content_length = 0;
+    bool expect_continue = false;
+    for (char *line = strstr(version, "\r\n") + 2; line < body;
+         line = strstr(line, "\r\n") + 2) {
+      char *colon = strchr(line, ':');
+      if (colon == NULL || colon > strstr(line, "\r\n"))
+        continue;
+      char *value = colon + 1 + strspn(colon + 1, " \t");
+      if (strncasecmp(line, "Content-Length:", colon + 1 - line) == 0)
+        content_length = strtoul(value, NULL, 10);
+      if (strncasecmp(line, "Connection:", colon + 1 - line) == 0)
+        keep_alive = strncasecmp(value, "close", 5) != 0 &&
+                     (keep_alive || strncasecmp(value, "keep-alive", 10) == 0);
+      if (strncasecmp(line, "Expect:", colon + 1 - line) == 0)
+        expect_continue = strncasecmp(value, "100-continue", 12) == 0;
+    }
+
+    // read until we have the entire body of the request
+    size_t head_len = body - worker->req;
+    if (head_len + content_length > sizeof worker->req - 1) {
+      respond(fd, "413 Content Too Large", "", 0, false);
+      return;
+    }
+    if (expect_continue && len < head_len + content_length)
+      if (write(fd, "HTTP/1.1 100 Continue\r\n\r\n", 25) != 25)
+        return;
+    while (len < head_len + content_length) {
+      ssize_t n = read(fd, worker->req + len, sizeof worker->req - 1 - len);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return;
+      len += n;
+    }
+
+    // the handlers expect a NUL-terminated body, but what follows it may be
+    // the beginning of a pipelined request, so put it back once we're done
+    char next = body[content_length];
+    body[content_length] = '\0';
+
+    struct route *route = NULL;
+    for (size_t r = 0; r < sizeof routes / sizeof *routes; r++)
+      if (strlen(routes[r].path) == path_len &&
+          strncmp(routes[r].path, path, path_len) == 0)
+        route = routes + r;
+
+    int res_len = -1;
+    if (route != NULL && route->handler == move)
+      res_len = move_since(worker->res, sizeof worker->res, body, arrival);
+    else if (route != NULL)
+      res_len = route->handler(worker->res, sizeof worker->res, body);
+
+    if (route == NULL)
+      keep_alive = respond(fd, "404 Not Found", "", 0, keep_alive);
+    else if (res_len < 0 || (size_t)res_len >= sizeof worker->res)
+      keep_alive = respond(fd, "400 Bad Request", "", 0, keep_alive);
+    else
+      keep_alive = respond(fd, "200 OK", worker->res, res_len, keep_alive);
+    // telemetry waits for the reply to be out, see `telemetry_flush()`
+    if (route != NULL && route->handler == move)
+      telemetry_flush();
+
+    if (!keep_alive)
+      return;
+
+    body[content_length] = next;
+    len -= head_len + content_length;
+    memmove(worker->req, body + content_length, len);
+    worker->req[len] = '\0';
+  }
+}
+
+void *work(void *arg) {
+  struct worker *worker = arg;
+
+  for (;;) {
+    int fd = accept(sock, NULL, NULL);
+    if (fd == -1) {
+      if (errno != EINTR && errno != ECONNABORTED)
+        perror("accept");
+      continue;
+    }
+
+    // replies are small and latency-critical, so don't let Nagle's algorithm
+    // hold them back. close connections that sit idle for too long so they
+    // don't hog a worker forever
+    int one = 1;
+    struct timeval timeout = {.tv_sec = KEEPALIVE};
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one) == -1 ||
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout) == -1)
+      perror("setsockopt");
+
+    serve(worker, fd);
+    close(fd);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int port = argc > 1 ? atoi(argv[1]) : PORT;
+  pondering = true; // we outlive requests, so keep searching between them
+  telemetering = true; // and log to a single file, unlike a CGI per request
+  scheduling = true; // and see every search, so share the cores between them
+
+  // a client closing its connection while we're writing to it shouldn't take
+  // the whole server down
+  signal(SIGPIPE, SIG_IGN);
+
+  int one = 1;
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if ((sock = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    perror("socket"), exit(EXIT_FAILURE);
+  if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one) == -1)
+    perror("setsockopt"), exit(EXIT_FAILURE);
+  if (bind(sock, (struct sockaddr *)&addr, sizeof addr) == -1)
+    perror("bind"), exit(EXIT_FAILURE);
+  if (listen(sock, SOMAXCONN) == -1)
+    perror("listen"), exit(EXIT_FAILURE);
+
+  // the workers inherit the signal mask, so that these signals are only ever
+  // delivered to `sigwait()` below
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT), sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGUSR1);
+  if ((errno = pthread_sigmask(SIG_BLOCK, &signals, NULL)))
+    perror("pthread_sigmask"), exit(EXIT_FAILURE);
+
+  static struct worker workers[WORKERS];
+  for (int w = 0; w < WORKERS; w++)
+    if ((errno = pthread_create(&workers[w].thread, NULL, work, workers + w)))
+      perror("pthread_create"), exit(EXIT_FAILURE);
+
+  fprintf(stderr, "listening on port %d\n", port);
+
+  // aggregate telemetry: `kill -USR1` writes out the latency and depth
+  // histograms of every search so far, and so does shutting down
+  for (int sig; sigwait(&signals, &sig) == 0 && sig == SIGUSR1;)
+    telemetry_dump(stderr);
+  telemetry_dump(stderr);
+}